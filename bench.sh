@@ -0,0 +1,30 @@
+#!/bin/bash
+
+YELLOW='\033[0;33m'
+NOCOLOR='\033[0m'
+
+compiler="./bin/clox"
+dir="./benchmark"
+
+# C微基准
+for bench in $(find ./bin -name 'bench-*'); do
+    echo "${YELLOW}${bench##*/}${NOCOLOR}"
+    $bench
+    echo
+done
+
+# 生成的百万行脚本 常量与跳转都超出一般格式的范围
+${dir}/long.sh 1000000 > ./bin/long.lox
+
+# 脚本基准 分别在不优化、-O与-R下运行
+for option in "" "-O" "-R"; do
+for file in $(find ${dir} -name '*.lox') ./bin/long.lox; do
+    start_time=$(date +%s%N)
+    $compiler ${option} $file > /dev/null
+    end_time=$(date +%s%N)
+    runtime=$(((end_time - start_time) / 1000000))
+    echo "${YELLOW}${file##*/}${NOCOLOR} ${option}\tExecuted in $runtime ms"
+done
+done
+
+echo "=====Bench Done====="
@@ -0,0 +1,110 @@
+// 编译吞吐量: 由大量数字字面量组成的生成源码, 以及字面量解析本身与strtod的对照
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/include/compiler.h"
+#include "../src/include/number.h"
+#include "../src/include/vm.h"
+
+#define GROUPS 20
+#define FUNCTIONS 100
+#define LITERALS 100
+#define ROUNDS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 单个chunk最多256个常量: 字面量分散到嵌套的局部函数中
+static char* generate(int* literalCount) {
+    size_t capacity = (size_t)GROUPS * FUNCTIONS * (LITERALS * 16 + 64);
+    char* source = (char*)malloc(capacity);
+    size_t length = 0;
+    *literalCount = 0;
+    for (int f = 0; f < GROUPS * FUNCTIONS; f++) {
+        if (f % FUNCTIONS == 0) {
+            length += sprintf(source + length, "fun g%d() {\n", f / FUNCTIONS);
+        }
+        length += sprintf(source + length, "fun f%d() {\n  return 0", f);
+        for (int i = 0; i < LITERALS; i++) {
+            int r = rand();
+            char* end = source + length;
+            switch (i % 4) {
+                case 0: length += sprintf(end, " + %d", r % 1000); break;
+                case 1: length += sprintf(end, " + %d", r); break;
+                case 2: length += sprintf(end, " + %d.%02d", r % 100, r % 97); break;
+                default: length += sprintf(end, " + 0.%09d", r % 1000000000); break;
+            }
+            (*literalCount)++;
+        }
+        length += sprintf(source + length, ";\n}\n");
+        if (f % FUNCTIONS == FUNCTIONS - 1) {
+            length += sprintf(source + length, "}\n");
+        }
+    }
+    source[length] = '\0';
+    return source;
+}
+
+int main() {
+    int literals;
+    srand(1);
+    char* source = generate(&literals);
+    size_t size = strlen(source);
+
+    // 收集字面量的位置 单独比较解析函数
+    const char** starts = (const char**)malloc(sizeof(char*) * literals);
+    int* lengths = (int*)malloc(sizeof(int) * literals);
+    int found = 0;
+    for (const char* c = source; *c != '\0' && found < literals; c++) {
+        if (c[0] == '+' && c[1] == ' ') {
+            const char* end = c + 2;
+            while ((*end >= '0' && *end <= '9') || *end == '.') end++;
+            starts[found] = c + 2;
+            lengths[found++] = (int)(end - c - 2);
+        }
+    }
+
+    volatile double sink = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < found; i++) sink += strtod(starts[i], NULL);
+    double strtodTime = now() - start;
+
+    start = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < found; i++) sink += parseNumber(starts[i], lengths[i]);
+    double parseTime = now() - start;
+
+    initVM();
+    double best = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        start = now();
+        ObjFunction* function = compile(source);
+        double elapsed = now() - start;
+        if (function == NULL) {
+            fprintf(stderr, "compile failed\n");
+            return 1;
+        }
+        if (elapsed < best) best = elapsed;
+    }
+    freeVM();
+
+    printf("%d literals, %.1f MB source\n", literals, size / 1e6);
+    printf("%14s %10.1f ns/literal\n", "strtod",
+           strtodTime * 1e9 / ((double)ROUNDS * found));
+    printf("%14s %10.1f ns/literal\n", "parseNumber",
+           parseTime * 1e9 / ((double)ROUNDS * found));
+    printf("%14s %10.1f MB/s  %.1f ms\n", "compile", size / best / 1e6,
+           best * 1e3);
+
+    free(starts);
+    free(lengths);
+    free(source);
+    return 0;
+}
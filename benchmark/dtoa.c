@@ -0,0 +1,66 @@
+// 数字格式化: formatNumber 与 printf("%g") / printf("%.17g") 的对照
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/include/number.h"
+
+#define COUNT 1000000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 混合输入: 小整数、大整数、短小数、计算结果、极大极小值
+static double sample(int i) {
+    switch (i % 5) {
+        case 0: return rand() % 1000;
+        case 1: return (double)rand() * rand();
+        case 2: return (rand() % 100000) / 100.0;
+        case 3: return (double)rand() / RAND_MAX * 3.0;
+        default: return (double)rand() / RAND_MAX * (i % 2 ? 1e200 : 1e-200);
+    }
+}
+
+int main() {
+    double* values = (double*)malloc(sizeof(double) * COUNT);
+    char buffer[NUMBER_BUFFER_SIZE];
+    srand(1);
+    for (int i = 0; i < COUNT; i++) values[i] = sample(i);
+
+    volatile size_t sink = 0;
+    double start = now();
+    for (int i = 0; i < COUNT; i++)
+        sink += snprintf(buffer, sizeof(buffer), "%g", values[i]);
+    double gTime = now() - start;
+
+    start = now();
+    for (int i = 0; i < COUNT; i++)
+        sink += snprintf(buffer, sizeof(buffer), "%.17g", values[i]);
+    double g17Time = now() - start;
+
+    start = now();
+    for (int i = 0; i < COUNT; i++) sink += formatNumber(values[i], buffer);
+    double formatTime = now() - start;
+
+    // 统计%g丢失精度、formatNumber无法还原的数量
+    int gLossy = 0, wrong = 0;
+    for (int i = 0; i < COUNT; i++) {
+        snprintf(buffer, sizeof(buffer), "%g", values[i]);
+        if (strtod(buffer, NULL) != values[i]) gLossy++;
+        formatNumber(values[i], buffer);
+        if (strtod(buffer, NULL) != values[i]) wrong++;
+    }
+
+    printf("%14s %10s %12s\n", "", "ns/value", "not exact");
+    printf("%14s %10.1f %12d\n", "%g", gTime * 1e9 / COUNT, gLossy);
+    printf("%14s %10.1f %12d\n", "%.17g", g17Time * 1e9 / COUNT, 0);
+    printf("%14s %10.1f %12d\n", "formatNumber", formatTime * 1e9 / COUNT, wrong);
+
+    free(values);
+    return 0;
+}
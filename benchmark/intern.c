@@ -0,0 +1,88 @@
+// 字符串驻留吞吐量: 不同长度下copyString的命中(已驻留)与未命中(新建)开销
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/include/vm.h"
+#include "../src/include/hash.h"
+#include "../src/include/memory.h"
+#include "../src/include/object.h"
+
+#define POOL_SIZE 4096
+#define ROUNDS 64
+
+// 旧的逐字节FNV-1a 作为对照
+static uint32_t fnv1a(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    static const int lengths[] = {4, 8, 16, 32, 64, 256, 1024, 4096};
+    int count = sizeof(lengths) / sizeof(lengths[0]);
+
+    initVM();
+    printf("%8s %12s %12s %12s %12s\n", "length", "fnv MB/s",
+           "wyhash MB/s", "miss ns/op", "hit ns/op");
+
+    for (int l = 0; l < count; l++) {
+        int length = lengths[l];
+        char* pool = (char*)malloc((size_t)POOL_SIZE * length);
+        for (int i = 0; i < POOL_SIZE * length; i++) {
+            pool[i] = 'a' + rand() % 26;
+        }
+
+        // 纯哈希吞吐
+        volatile uint64_t sink = 0;
+        double start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            for (int i = 0; i < POOL_SIZE; i++)
+                sink += fnv1a(pool + (size_t)i * length, length);
+        double fnvTime = now() - start;
+
+        start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            for (int i = 0; i < POOL_SIZE; i++)
+                sink += hashBytes(pool + (size_t)i * length, length,
+                                  HASH_SEED);
+        double wyTime = now() - start;
+
+        // 首次驻留(新建字符串) 对象留在栈上防止被回收
+        start = now();
+        for (int i = 0; i < POOL_SIZE; i++) {
+            push(OBJ_VAL(copyString(pool + (size_t)i * length, length)));
+        }
+        double missTime = now() - start;
+
+        // 再次驻留(命中已有字符串)
+        start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            for (int i = 0; i < POOL_SIZE; i++)
+                copyString(pool + (size_t)i * length, length);
+        double hitTime = now() - start;
+
+        vm.stackTop -= POOL_SIZE;
+        collectGarbage();
+
+        double bytes = (double)ROUNDS * POOL_SIZE * length;
+        printf("%8d %12.1f %12.1f %12.1f %12.1f\n", length,
+               bytes / fnvTime / 1e6, bytes / wyTime / 1e6,
+               missTime * 1e9 / POOL_SIZE,
+               hitTime * 1e9 / ((double)ROUNDS * POOL_SIZE));
+        free(pool);
+    }
+
+    freeVM();
+    return 0;
+}
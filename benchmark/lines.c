@@ -0,0 +1,81 @@
+// 编译吞吐量(行/秒): 生成的大型源码, 函数、类、局部变量与全局变量混合
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/include/compiler.h"
+#include "../src/include/memory.h"
+#include "../src/include/vm.h"
+
+#define ROUNDS 5
+
+static const int SIZES[] = {10000, 100000, 400000};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 每个单元17行: 一个函数与一个类, 反复引用同一批名字与字面量
+static const char* UNIT =
+    "fun work%d(n, scale) {\n"
+    "  var total = 0;\n"
+    "  var label = \"work\";\n"
+    "  for (var i = 0; i < n; i = i + 1) {\n"
+    "    if (i > limit and total < 1000000) total = total + i * scale;\n"
+    "    else total = total - 1.5;\n"
+    "  }\n"
+    "  fun inner(x) { return x + total + offset; }\n"
+    "  return inner(total) + counter;\n"
+    "}\n"
+    "class Shape%d {\n"
+    "  init(w, h) { this.w = w; this.h = h; }\n"
+    "  area() { return this.w * this.h; }\n"
+    "  describe() { return \"shape\" + \" of area \"; }\n"
+    "}\n"
+    "var result%d = work%d(3, 2);\n"
+    "counter = counter + 1;\n";
+
+#define UNIT_LINES 17
+
+static char* generate(int lines) {
+    int units = lines / UNIT_LINES;
+    size_t capacity = (size_t)units * (strlen(UNIT) + 64) + 256;
+    char* source = (char*)malloc(capacity);
+    size_t length = sprintf(source,
+                            "var limit = 10;\nvar offset = 2;\nvar counter = 0;\n");
+    for (int u = 0; u < units; u++) {
+        length += sprintf(source + length, UNIT, u, u, u, u);
+    }
+    return source;
+}
+
+int main() {
+    initVM();
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++) {
+        char* source = generate(SIZES[s]);
+        int lines = 0;
+        for (const char* c = source; *c != '\0'; c++) lines += *c == '\n';
+
+        double best = 1e9;
+        for (int r = 0; r < ROUNDS; r++) {
+            double start = now();
+            ObjFunction* function = compile(source);
+            double elapsed = now() - start;
+            if (function == NULL) {
+                fprintf(stderr, "compile failed\n");
+                return 1;
+            }
+            if (elapsed < best) best = elapsed;
+            collectGarbage(); // 上一轮的函数不计入下一轮
+        }
+        printf("%8d lines %10.0f lines/s  %.1f ms\n", lines, lines / best,
+               best * 1e3);
+        free(source);
+    }
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+# 生成约N行的脚本: 常量下标、跳转与循环偏移量都超出一般格式
+lines=${1:-1000000}
+awk -v n=$((lines / 2 - 20)) 'BEGIN {
+    for (i = 0; i < n; i++) printf "var g%d = %d.5;\n", i, i;
+    print "class C {";
+    for (i = 0; i < 10; i++) printf "    m%d() { return %d; }\n", i, i;
+    print "}";
+    print "var o = C();";
+    print "var sum = 0;";
+    print "var i = 0;";
+    print "while (i < 2) {";
+    print "    if (i >= 0) {";
+    for (i = 0; i < n; i++) printf "        sum = sum + g%d;\n", i;
+    print "    }";
+    print "    sum = sum + o.m9();";
+    print "    i = i + 1;";
+    print "}";
+    print "print sum;";
+}'
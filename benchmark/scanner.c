@@ -0,0 +1,86 @@
+// 扫描吞吐量(词法单元/秒): 以代码为主的源码, 以及注释与长字符串为主的源码
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/include/scanner.h"
+
+#define UNITS 40000
+#define ROUNDS 20
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 一个带简短注释的函数, 名字与字面量都不长
+static const char* CODE =
+    "// computeRunningTotal%d: accumulates weighted samples\n"
+    "fun computeRunningTotal%d(sampleCount, weightFactor) {\n"
+    "    var runningTotal = 0;\n"
+    "    var progressLabel = \"progress\";\n"
+    "    for (var index = 0; index < sampleCount; index = index + 1) {\n"
+    "        runningTotal = runningTotal + index * weightFactor * 1.25;\n"
+    "        if (index > 123456) print progressLabel;\n"
+    "    }\n"
+    "    return runningTotal;\n"
+    "}\n"
+    "\n";
+
+// 大段文档注释与跨行字符串, 代码很少
+static const char* PROSE =
+    "// ------------------------------------------------------------------\n"
+    "// describe%d returns the help text shown by the command line tool.\n"
+    "// The text is kept verbatim so that translators can find it easily,\n"
+    "// and every line is wrapped at seventy characters by hand.\n"
+    "// ------------------------------------------------------------------\n"
+    "fun describe%d() {\n"
+    "        return \"usage: tool [options] file\n"
+    "  --verbose        print every step while processing the input\n"
+    "  --output path    write the result to path instead of stdout\n"
+    "\";\n"
+    "}\n"
+    "\n";
+
+static char* generate(const char* unit, size_t* length) {
+    size_t capacity = (size_t)UNITS * (strlen(unit) + 32) + 1;
+    char* source = (char*)malloc(capacity);
+    *length = 0;
+    for (int u = 0; u < UNITS; u++) {
+        *length += sprintf(source + *length, unit, u, u);
+    }
+    return source;
+}
+
+static void measure(const char* name, const char* unit) {
+    size_t length;
+    char* source = generate(unit, &length);
+
+    long tokens = 0;
+    double best = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        double start = now();
+        initScanner(source);
+        long count = 0;
+        for (;;) {
+            Token token = scanToken();
+            count++;
+            if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) break;
+        }
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+        tokens = count;
+    }
+    printf("%-6s %8ld tokens %5.1f MB %11.0f tokens/s %6.0f MB/s\n", name,
+           tokens, length / 1e6, tokens / best, length / 1e6 / best);
+    free(source);
+}
+
+int main() {
+    measure("code", CODE);
+    measure("prose", PROSE);
+    return 0;
+}
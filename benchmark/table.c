@@ -0,0 +1,65 @@
+// 小表查找延迟与内存: 模拟拥有1~16个成员的类方法表/实例字段表
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/include/vm.h"
+#include "../src/include/table.h"
+#include "../src/include/object.h"
+
+#define LOOKUPS 20000000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 旧实现: 容量从8起按2倍增长, 负载上限0.75, 每个槽一个Entry
+static size_t oldTableSize(int count) {
+    int capacity = 0;
+    for (int i = 0; i < count; i++) {
+        if (i + 1 > capacity * 0.75) capacity = capacity < 8 ? 8 : capacity * 2;
+    }
+    return sizeof(Entry) * capacity;
+}
+
+int main() {
+    initVM();
+
+    ObjString* names[16];
+    for (int i = 0; i < 16; i++) {
+        char name[16];
+        int length = snprintf(name, sizeof(name), "member%d", i);
+        names[i] = copyString(name, length);
+        push(OBJ_VAL(names[i]));
+    }
+
+    printf("%8s %10s %12s %12s %12s\n", "members", "capacity",
+           "bytes", "old bytes", "hit ns/op");
+    for (int count = 1; count <= 16; count++) {
+        Table table;
+        initTable(&table);
+        size_t before = vm.bytesAllocated;
+        for (int i = 0; i < count; i++) {
+            tableSet(&table, names[i], NUMBER_VAL(i));
+        }
+        size_t bytes = vm.bytesAllocated - before;
+
+        volatile double sink = 0;
+        Value value;
+        double start = now();
+        for (int i = 0; i < LOOKUPS; i++) {
+            tableGet(&table, names[i % count], &value);
+            sink += AS_NUMBER(value);
+        }
+        double elapsed = now() - start;
+
+        printf("%8d %10d %12zu %12zu %12.2f\n", count, table.capacity,
+               bytes, oldTableSize(count), elapsed * 1e9 / LOOKUPS);
+        freeTable(&table);
+    }
+
+    freeVM();
+    return 0;
+}
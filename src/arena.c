@@ -0,0 +1,65 @@
+#include <stdlib.h>
+
+#include "include/arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void initArena(Arena* arena) {
+    arena->block = NULL;
+    arena->spare = NULL;
+}
+
+void freeArena(Arena* arena) {
+    while (arena->block != NULL) {
+        ArenaBlock* previous = arena->block->previous;
+        free(arena->block);
+        arena->block = previous;
+    }
+    free(arena->spare);
+    arena->spare = NULL;
+}
+
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock* block = arena->block;
+    if (block == NULL || block->size - block->used < size) {
+        // 超过一块大小的请求单独占一块
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        if (arena->spare != NULL && arena->spare->size >= capacity) {
+            block = arena->spare;
+            arena->spare = NULL;
+        } else {
+            block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + capacity);
+            if (block == NULL) exit(1);
+            block->size = capacity;
+        }
+        block->used = 0;
+        block->previous = arena->block;
+        arena->block = block;
+    }
+    void* result = block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+ArenaMark arenaMark(Arena* arena) {
+    ArenaMark mark;
+    mark.block = arena->block;
+    mark.used = arena->block != NULL ? arena->block->used : 0;
+    return mark;
+}
+
+void arenaRelease(Arena* arena, ArenaMark mark) {
+    while (arena->block != mark.block) {
+        ArenaBlock* block = arena->block;
+        arena->block = block->previous;
+        // 留一块备用 嵌套函数反复跨块时不必每次都重新分配
+        if (arena->spare == NULL || arena->spare->size < block->size) {
+            free(arena->spare);
+            arena->spare = block;
+        } else {
+            free(block);
+        }
+    }
+    if (mark.block != NULL) mark.block->used = mark.used;
+}
@@ -0,0 +1,510 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/bytecode.h"
+#include "include/compiler.h"
+#include "include/hash.h"
+#include "include/memory.h"
+#include "include/vm.h"
+
+// 常量的类型标记
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+    CONSTANT_FUNCTION_REF, // 已写出的函数 按写出顺序的下标引用
+} ConstantTag;
+
+// 已写出(读入)的函数, 同一函数对象只写出一次
+// 内联守卫靠函数对象的同一性判断被调用者是否改变, 载入后必须仍是同一个对象
+typedef struct {
+    ObjFunction** functions;
+    int count;
+    int capacity;
+} FunctionList;
+
+static void appendFunction(FunctionList* list, ObjFunction* function) {
+    if (list->count == list->capacity) {
+        list->capacity = GROW_CAPACITY(list->capacity);
+        list->functions = (ObjFunction**)realloc(list->functions,
+            sizeof(ObjFunction*) * list->capacity);
+        if (list->functions == NULL) exit(1);
+    }
+    list->functions[list->count++] = function;
+}
+
+static const char MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+// 构建标识: Makefile传入解释器源码的校验和, 直接编译时退而使用编译时间
+#ifndef CLOX_BUILD_ID
+#define CLOX_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+uint64_t bytecodeKey(const char* source) {
+    // 指令数量随指令集变化, 一并计入;
+    // 编译器改动未必改变版本或指令集, 由构建标识区分不同的编译器
+    uint64_t build = hashBytes(CLOX_BUILD_ID, sizeof(CLOX_BUILD_ID) - 1,
+                               HASH_SEED);
+    uint64_t seed = build ^ ((uint64_t)BYTECODE_VERSION << 32) ^
+                    ((uint64_t)OP_RETURN << 40) ^
+                    ((uint64_t)compileOptions.optimizeLevel << 48) ^
+                    ((uint64_t)compileOptions.registers << 56);
+    return hashBytes(source, strlen(source), seed);
+}
+
+static void writeU8(FILE* file, uint8_t value) {
+    fputc(value, file);
+}
+
+static void writeU32(FILE* file, uint32_t value) {
+    for (int i = 0; i < 4; i++) fputc((value >> (8 * i)) & 0xff, file);
+}
+
+static void writeU64(FILE* file, uint64_t value) {
+    for (int i = 0; i < 8; i++) fputc((value >> (8 * i)) & 0xff, file);
+}
+
+// 长度为-1表示没有字符串(顶层函数的函数名)
+// 字符后补'\0', 载入时字符串直接引用映射中的字符
+static void writeText(FILE* file, ObjString* string) {
+    if (string == NULL) {
+        writeU32(file, UINT32_MAX);
+        return;
+    }
+    writeU32(file, (uint32_t)string->length);
+    fwrite(string->chars, 1, string->length, file);
+    writeU8(file, '\0');
+}
+
+// 补0对齐到4字节 行号表载入后直接当作int数组使用
+static void writePadding(FILE* file) {
+    long position = ftell(file);
+    while (position > 0 && position % 4 != 0) {
+        writeU8(file, 0);
+        position++;
+    }
+}
+
+// 读回校验和之后的全部内容, 算出哈希后写入checksumAt处
+static void writeChecksum(FILE* file, long checksumAt) {
+    long start = checksumAt + 8;
+    if (fseek(file, 0, SEEK_END) != 0) return;
+    long end = ftell(file);
+    char* body = (char*)malloc(end > start ? end - start : 1);
+    if (body == NULL) exit(1);
+    fseek(file, start, SEEK_SET);
+    size_t length = fread(body, 1, end - start, file);
+    uint64_t checksum = hashBytes(body, length, HASH_SEED);
+    free(body);
+    fseek(file, checksumAt, SEEK_SET);
+    writeU64(file, checksum);
+}
+
+static void writeFunction(FILE* file, FunctionList* written,
+                          ObjFunction* function) {
+    appendFunction(written, function);
+    Chunk* chunk = &function->chunk;
+    writeU32(file, (uint32_t)function->arity);
+    writeU32(file, (uint32_t)function->upvalueCount);
+    writeText(file, function->name);
+
+    writeU32(file, (uint32_t)chunk->count);
+    fwrite(chunk->code, 1, chunk->count, file);
+    writeU32(file, (uint32_t)chunk->lineCount);
+    writePadding(file);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        writeU32(file, (uint32_t)chunk->lines[i].offset);
+        writeU32(file, (uint32_t)chunk->lines[i].line);
+    }
+
+    writeU32(file, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_NIL(value)) {
+            writeU8(file, CONSTANT_NIL);
+        } else if (IS_BOOL(value)) {
+            writeU8(file, AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE);
+        } else if (IS_NUMBER(value)) {
+            double number = AS_NUMBER(value);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            writeU8(file, CONSTANT_NUMBER);
+            writeU64(file, bits);
+        } else if (IS_STRING(value)) {
+            // 编译期的常量都是平坦字符串
+            writeU8(file, CONSTANT_STRING);
+            writeText(file, AS_STRING(value));
+        } else {
+            ObjFunction* constant = AS_FUNCTION(value);
+            int index = 0;
+            while (index < written->count &&
+                   written->functions[index] != constant) {
+                index++;
+            }
+            if (index < written->count) {
+                writeU8(file, CONSTANT_FUNCTION_REF);
+                writeU32(file, (uint32_t)index);
+            } else {
+                writeU8(file, CONSTANT_FUNCTION);
+                writeFunction(file, written, constant);
+            }
+        }
+    }
+}
+
+bool writeBytecode(ObjFunction* function, uint64_t key, const char* path) {
+    // 写入临时文件后改名 其他进程不会读到写了一半的文件
+    size_t length = strlen(path) + 32;
+    char* temporary = (char*)malloc(length);
+    if (temporary == NULL) return false;
+    snprintf(temporary, length, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE* file = fopen(temporary, "w+b");
+    if (file == NULL) {
+        free(temporary);
+        return false;
+    }
+    fwrite(MAGIC, 1, sizeof(MAGIC), file);
+    writeU32(file, BYTECODE_VERSION);
+    writeU64(file, key);
+    long checksumAt = ftell(file);
+    writeU64(file, 0); // 校验和 写完函数后回填
+    FunctionList written = {NULL, 0, 0};
+    writeFunction(file, &written, function);
+    free(written.functions);
+    writeChecksum(file, checksumAt);
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temporary, path) == 0;
+    if (!ok) remove(temporary);
+    free(temporary);
+    return ok;
+}
+
+// 读取位置 越界后failed置位, 之后读到的都是0
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+    bool failed;
+} Reader;
+
+static const uint8_t* readBytes(Reader* reader, size_t count) {
+    if (reader->failed || reader->length - reader->position < count) {
+        reader->failed = true;
+        return NULL;
+    }
+    const uint8_t* bytes = reader->data + reader->position;
+    reader->position += count;
+    return bytes;
+}
+
+static uint8_t readU8(Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, 1);
+    return bytes == NULL ? 0 : bytes[0];
+}
+
+static uint32_t readU32(Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, 4);
+    if (bytes == NULL) return 0;
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)bytes[i] << (8 * i);
+    return value;
+}
+
+static uint64_t readU64(Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, 8);
+    if (bytes == NULL) return 0;
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)bytes[i] << (8 * i);
+    return value;
+}
+
+// 跳过对齐用的补位
+static void skipPadding(Reader* reader) {
+    size_t padding = (4 - reader->position % 4) % 4;
+    readBytes(reader, padding);
+}
+
+// 函数名为空时返回NULL而不置位failed
+static ObjString* readText(Reader* reader) {
+    uint32_t length = readU32(reader);
+    if (length == UINT32_MAX) return NULL;
+    const uint8_t* chars = readBytes(reader, (size_t)length + 1);
+    if (chars == NULL) return NULL;
+    if (chars[length] != '\0') {
+        reader->failed = true;
+        return NULL;
+    }
+    return borrowString((const char*)chars, (int)length);
+}
+
+// 常量下标处是满足check的常量
+static bool constantIs(Chunk* chunk, int index, bool (*check)(Value)) {
+    return index < chunk->constants.count &&
+           (check == NULL || check(chunk->constants.values[index]));
+}
+
+static bool isStringValue(Value value) {
+    return IS_STRING(value);
+}
+
+static bool isFunctionValue(Value value) {
+    return IS_FUNCTION(value);
+}
+
+// 跳转目标须是代码之内某条指令的起点
+static bool validTarget(const bool* starts, int count, int target) {
+    return target >= 0 && target < count && starts[target];
+}
+
+/*
+ * 载入的代码逐条检查后才交给虚拟机: 操作码在范围内、指令不越过代码末尾、
+ * 常量下标在常量表之内且类型相符、上值下标小于上值数量、跳转落在指令起点,
+ * 最后一条是OP_RETURN。局部变量槽位只有一个字节, 不会越出栈的范围
+ */
+static bool validCode(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    bool* starts = (bool*)calloc(chunk->count, sizeof(bool));
+    if (starts == NULL) exit(1);
+    bool valid = true;
+    int last = 0;
+    for (int offset = 0; offset < chunk->count && valid;) {
+        uint8_t* code = chunk->code + offset;
+        uint8_t op = code[0];
+        starts[offset] = true;
+        last = offset;
+        if (op > OP_RETURN) {
+            valid = false;
+            break;
+        }
+        // OP_CLOSURE的长度取决于常量中的函数, 先检查常量
+        int operands = normalForm(op) != op ? 3 : 1;
+        if (normalForm(op) == OP_CLOSURE &&
+            (offset + 1 + operands > chunk->count ||
+             !constantIs(chunk, constantOperand(chunk, offset),
+                         isFunctionValue))) {
+            valid = false;
+            break;
+        }
+        int length = instructionLength(chunk, offset);
+        if (offset + length > chunk->count) {
+            valid = false;
+            break;
+        }
+        switch (normalForm(op)) {
+            case OP_CONSTANT:
+                valid = constantIs(chunk, constantOperand(chunk, offset), NULL);
+                break;
+            case OP_GET_GLOBAL: case OP_DEFINE_GLOBAL: case OP_SET_GLOBAL:
+            case OP_GET_PROPERTY: case OP_SET_PROPERTY: case OP_GET_SUPER:
+            case OP_CLASS: case OP_METHOD:
+                valid = constantIs(chunk, constantOperand(chunk, offset),
+                                   isStringValue);
+                break;
+            case OP_INVOKE: case OP_SUPER_INVOKE:
+                valid = constantIs(chunk, code[1], isStringValue);
+                break;
+            case OP_GET_LOCAL_CONSTANT:
+                valid = constantIs(chunk, code[2], NULL);
+                break;
+            case OP_INLINE_GUARD:
+                valid = constantIs(chunk, code[1], isFunctionValue);
+                break;
+            case OP_GET_UPVALUE: case OP_SET_UPVALUE: case OP_GET_CAPTURED:
+                valid = code[1] < function->upvalueCount;
+                break;
+            case OP_GET_UPVALUE_0:
+                valid = function->upvalueCount > 0;
+                break;
+            default:
+                break;
+        }
+        if (normalForm(op) == OP_CLOSURE) {
+            // 捕获外层上值时下标须小于外层的上值数量
+            for (int i = 1 + operands; i < length && valid; i += 2) {
+                uint8_t kind = code[i];
+                valid = kind <= CAPTURE_UPVALUE_VALUE &&
+                        ((kind != CAPTURE_UPVALUE &&
+                          kind != CAPTURE_UPVALUE_VALUE) ||
+                         code[i + 1] < function->upvalueCount);
+            }
+        }
+        offset += length;
+    }
+    valid = valid && chunk->code[last] == OP_RETURN;
+
+    // 指令起点都已标出后再检查跳转目标
+    for (int offset = 0; offset < chunk->count && valid;
+         offset += instructionLength(chunk, offset)) {
+        uint8_t* code = chunk->code + offset;
+        uint8_t op = normalForm(code[0]);
+        int length = instructionLength(chunk, offset);
+        int distance;
+        switch (op) {
+            case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_TRUE:
+            case OP_LOOP:
+                distance = op == code[0]
+                    ? (code[1] << 8) | code[2] : readLong(code + 1);
+                if (op == OP_LOOP) distance = -distance;
+                valid = validTarget(starts, chunk->count,
+                                    offset + length + distance);
+                break;
+            case OP_INLINE_GUARD:
+                valid = validTarget(starts, chunk->count,
+                                    offset + length + ((code[3] << 8) | code[4]));
+                break;
+            default:
+                break;
+        }
+    }
+    free(starts);
+    return valid;
+}
+
+// 代码、行号表与字符串的字符都直接引用映射, 不做复制
+// 构造过程中函数留在栈上 常量经addConstant压栈 都不会被回收
+static ObjFunction* readFunction(Reader* reader, FunctionList* loaded) {
+    ObjFunction* function = newFunction();
+    push(OBJ_VAL(function));
+    appendFunction(loaded, function);
+    uint32_t arity = readU32(reader);
+    uint32_t upvalueCount = readU32(reader);
+    // 参数与上值数量都受一个字节的操作数限制
+    if (arity > UINT8_MAX || upvalueCount > UINT8_COUNT) reader->failed = true;
+    function->arity = reader->failed ? 0 : (int)arity;
+    function->upvalueCount = reader->failed ? 0 : (int)upvalueCount;
+    function->name = readText(reader);
+
+    Chunk* chunk = &function->chunk;
+    uint32_t count = readU32(reader);
+    const uint8_t* code = readBytes(reader, count);
+    uint32_t lineCount = readU32(reader);
+    skipPadding(reader);
+    const uint8_t* lines = readBytes(reader,
+                                      (size_t)lineCount * sizeof(LineStart));
+    // 空的代码或行号表不是编译器写出的
+    if (count == 0 || lineCount == 0) reader->failed = true;
+    if (code != NULL && lines != NULL && !reader->failed) {
+        // 映射是只读的, 共享的chunk之后不会再被写入
+        chunk->code = (uint8_t*)code;
+        chunk->lines = (LineStart*)lines;
+        chunk->count = chunk->capacity = (int)count;
+        chunk->lineCount = chunk->lineCapacity = (int)lineCount;
+        chunk->shared = true;
+        // 各段的起点须从0开始递增且落在代码之内
+        for (uint32_t i = 0; i < lineCount; i++) {
+            int offset = chunk->lines[i].offset;
+            if (offset >= (int)count ||
+                (i == 0 ? offset != 0 : offset <= chunk->lines[i - 1].offset)) {
+                reader->failed = true;
+            }
+        }
+    }
+
+    uint32_t constants = readU32(reader);
+    for (uint32_t i = 0; i < constants && !reader->failed; i++) {
+        Value value = NIL_VAL;
+        switch (readU8(reader)) {
+            case CONSTANT_NIL: break;
+            case CONSTANT_FALSE: value = BOOL_VAL(false); break;
+            case CONSTANT_TRUE: value = BOOL_VAL(true); break;
+            case CONSTANT_NUMBER: {
+                uint64_t bits = readU64(reader);
+                double number;
+                memcpy(&number, &bits, sizeof(number));
+                value = NUMBER_VAL(number);
+                break;
+            }
+            case CONSTANT_STRING: {
+                ObjString* string = readText(reader);
+                if (string == NULL) reader->failed = true;
+                else value = OBJ_VAL(string);
+                break;
+            }
+            case CONSTANT_FUNCTION:
+                value = OBJ_VAL(readFunction(reader, loaded));
+                break;
+            case CONSTANT_FUNCTION_REF: {
+                uint32_t index = readU32(reader);
+                if (index < (uint32_t)loaded->count) {
+                    value = OBJ_VAL(loaded->functions[index]);
+                } else {
+                    reader->failed = true;
+                }
+                break;
+            }
+            default:
+                reader->failed = true;
+                break;
+        }
+        addConstant(chunk, value);
+    }
+    if (!reader->failed && !validCode(function)) reader->failed = true;
+    pop();
+    return function;
+}
+
+// 行号表按小端序直接引用 大端序主机上不能载入
+static bool littleEndian(void) {
+    uint32_t probe = 1;
+    uint8_t first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+ObjFunction* readBytecode(const char* path, uint64_t key) {
+    if (!littleEndian()) return NULL;
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) return NULL;
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || info.st_size <= 0) {
+        close(descriptor);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+    // 私有只读映射, 运行同一文件的进程共享页缓存中的同一份物理页
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED) return NULL;
+
+    Reader reader = {(const uint8_t*)data, size, 0, false};
+    const uint8_t* magic = readBytes(&reader, sizeof(MAGIC));
+    ObjFunction* function = NULL;
+    bool referenced = false;
+    if (magic != NULL && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        readU32(&reader) == BYTECODE_VERSION) {
+        uint64_t stored = readU64(&reader);
+        uint64_t checksum = readU64(&reader);
+        // 截断或损坏的文件(如写到一半的缓存)在校验和处即被拒绝
+        bool intact = !reader.failed &&
+            hashBytes(reader.data + reader.position,
+                      reader.length - reader.position, HASH_SEED) == checksum;
+        if (intact && (key == 0 || stored == key)) {
+            FunctionList loaded = {NULL, 0, 0};
+            referenced = true;
+            function = readFunction(&reader, &loaded);
+            free(loaded.functions);
+            // 顶层函数没有参数、上值与函数名
+            if (function->arity != 0 || function->upvalueCount != 0 ||
+                function->name != NULL) {
+                reader.failed = true;
+            }
+        }
+    }
+    // 文件须恰好读完 未读完或越界都视为损坏
+    if (reader.failed || reader.position != reader.length) function = NULL;
+    // 载入的对象引用着映射, 映射在进程结束前一直保留;
+    // 载入失败时已创建的对象(如驻留的字符串)也可能引用它, 同样保留
+    if (!referenced) munmap(data, size);
+    return function;
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "include/chunk.h"
 #include "include/memory.h"
 #include "include/vm.h"
@@ -8,13 +9,34 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+    chunk->shared = false;
+    chunk->packed = false;
+    chunk->wordCount = 0;
+    chunk->words = NULL;
+    chunk->wordOffsets = NULL;
     initValueArray(&chunk->constants);
 }
 
+// 收缩后整块内存的字节数 块从常量表开始
+static size_t packedSize(Chunk* chunk) {
+    return sizeof(Value) * chunk->constants.count +
+           sizeof(LineStart) * chunk->lineCount + chunk->count;
+}
+
 void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
-    freeValueArray(&chunk->constants);
+    if (chunk->packed) {
+        reallocate(chunk->constants.values, packedSize(chunk), 0);
+    } else {
+        if (!chunk->shared) {
+            FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+            FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+        }
+        freeValueArray(&chunk->constants);
+    }
+    FREE_ARRAY(uint32_t, chunk->words, chunk->wordCount);
+    FREE_ARRAY(int, chunk->wordOffsets, chunk->wordCount);
     initChunk(chunk);
 }
 
@@ -25,11 +47,14 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line)
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code,
             oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines,
-            oldCapacity, chunk->capacity);
     }
+    // 编译器撤销过的字节(常量折叠等)留下的段先丢弃
+    while (chunk->lineCount > 0 &&
+           chunk->lines[chunk->lineCount - 1].offset >= chunk->count) {
+        chunk->lineCount--;
+    }
+    addLine(chunk, chunk->count, line);
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
 
 }
@@ -42,4 +67,296 @@ int addConstant(Chunk* chunk, Value value)
 
     // 返回追加常量的索引以便定位
     return chunk->constants.count - 1;
+}
+
+void addLine(Chunk* chunk, int offset, int line)
+{
+    if (chunk->lineCount > 0 &&
+        chunk->lines[chunk->lineCount - 1].line == line) {
+        return;
+    }
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines,
+            oldCapacity, chunk->lineCapacity);
+    }
+    chunk->lines[chunk->lineCount].offset = offset;
+    chunk->lines[chunk->lineCount].line = line;
+    chunk->lineCount++;
+}
+
+int getLine(Chunk* chunk, int offset)
+{
+    // 最后一个起点不超过offset的段
+    int low = 0;
+    int high = chunk->lineCount - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (chunk->lines[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return chunk->lineCount > 0 ? chunk->lines[low].line : 0;
+}
+
+void packChunk(Chunk* chunk)
+{
+    if (chunk->shared || chunk->packed || packedSize(chunk) == 0) return;
+    // 常量在前保证Value的对齐, 行号表的起点随之按8字节对齐
+    size_t constants = sizeof(Value) * chunk->constants.count;
+    size_t lines = sizeof(LineStart) * chunk->lineCount;
+    char* block = (char*)reallocate(NULL, 0, packedSize(chunk));
+    if (constants > 0) memcpy(block, chunk->constants.values, constants);
+    if (lines > 0) memcpy(block + constants, chunk->lines, lines);
+    if (chunk->count > 0) {
+        memcpy(block + constants + lines, chunk->code, chunk->count);
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    FREE_ARRAY(Value, chunk->constants.values, chunk->constants.capacity);
+    chunk->constants.values = (Value*)block;
+    chunk->constants.capacity = chunk->constants.count;
+    chunk->lines = (LineStart*)(block + constants);
+    chunk->lineCapacity = chunk->lineCount;
+    chunk->code = (uint8_t*)(block + constants + lines);
+    chunk->capacity = chunk->count;
+    chunk->packed = true;
+}
+
+int instructionLength(Chunk* chunk, int offset)
+{
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_CAPTURED:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_PICK:
+        case OP_SMALL_INT:
+        case OP_STORE_LOCAL:
+        case OP_SLIDE:
+        case OP_CLASS:
+        case OP_METHOD:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 3;
+        case OP_INLINE_GUARD:
+            return 5;
+        case OP_GET_LOCAL_PAIR:
+        case OP_GET_LOCAL_CONSTANT:
+        case OP_INCREMENT_LOCAL:
+            return 3;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG:
+        case OP_GET_SUPER_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+        case OP_JUMP_LONG:
+        case OP_JUMP_IF_FALSE_LONG:
+        case OP_JUMP_IF_TRUE_LONG:
+        case OP_LOOP_LONG:
+            return 4;
+        case OP_CLOSURE:
+        case OP_CLOSURE_LONG: {
+            // 每个上值占两字节
+            ObjFunction* function = AS_FUNCTION(
+                chunk->constants.values[constantOperand(chunk, offset)]);
+            int operand = chunk->code[offset] == OP_CLOSURE ? 1 : 3;
+            return 1 + operand + function->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
+
+uint8_t expandShortForm(uint8_t op, uint8_t* operand)
+{
+    switch (op) {
+        case OP_GET_LOCAL_0: case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2: case OP_GET_LOCAL_3:
+            *operand = op - OP_GET_LOCAL_0;
+            return OP_GET_LOCAL;
+        case OP_GET_UPVALUE_0:
+            *operand = 0;
+            return OP_GET_UPVALUE;
+        case OP_CALL_0: case OP_CALL_1: case OP_CALL_2:
+            *operand = op - OP_CALL_0;
+            return OP_CALL;
+        default:
+            return op;
+    }
+}
+
+// 一般格式与对应的长格式
+static const uint8_t longForms[][2] = {
+    {OP_CONSTANT,      OP_CONSTANT_LONG},
+    {OP_GET_GLOBAL,    OP_GET_GLOBAL_LONG},
+    {OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG},
+    {OP_SET_GLOBAL,    OP_SET_GLOBAL_LONG},
+    {OP_GET_PROPERTY,  OP_GET_PROPERTY_LONG},
+    {OP_SET_PROPERTY,  OP_SET_PROPERTY_LONG},
+    {OP_GET_SUPER,     OP_GET_SUPER_LONG},
+    {OP_CLOSURE,       OP_CLOSURE_LONG},
+    {OP_CLASS,         OP_CLASS_LONG},
+    {OP_METHOD,        OP_METHOD_LONG},
+    {OP_JUMP,          OP_JUMP_LONG},
+    {OP_JUMP_IF_FALSE, OP_JUMP_IF_FALSE_LONG},
+    {OP_JUMP_IF_TRUE,  OP_JUMP_IF_TRUE_LONG},
+    {OP_LOOP,          OP_LOOP_LONG},
+};
+
+#define LONG_FORM_COUNT (sizeof(longForms) / sizeof(longForms[0]))
+
+uint8_t longForm(uint8_t op)
+{
+    for (size_t i = 0; i < LONG_FORM_COUNT; i++) {
+        if (longForms[i][0] == op) return longForms[i][1];
+    }
+    return op;
+}
+
+uint8_t normalForm(uint8_t op)
+{
+    for (size_t i = 0; i < LONG_FORM_COUNT; i++) {
+        if (longForms[i][1] == op) return longForms[i][0];
+    }
+    return op;
+}
+
+int readLong(uint8_t* code)
+{
+    return (code[0] << 16) | (code[1] << 8) | code[2];
+}
+
+int constantOperand(Chunk* chunk, int offset)
+{
+    uint8_t* code = chunk->code + offset;
+    return normalForm(code[0]) != code[0] ? readLong(code + 1) : code[1];
+}
+
+// 指令解码后占用的字数: 闭包的每个上值描述与内联守卫的跳转目标各多占一个字
+static int wordLength(Chunk* chunk, int offset)
+{
+    switch (chunk->code[offset]) {
+        case OP_CLOSURE:
+        case OP_CLOSURE_LONG: {
+            ObjFunction* function = AS_FUNCTION(
+                chunk->constants.values[constantOperand(chunk, offset)]);
+            return 1 + function->upvalueCount;
+        }
+        case OP_INLINE_GUARD:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+void decodeChunk(Chunk* chunk)
+{
+    FREE_ARRAY(uint32_t, chunk->words, chunk->wordCount);
+    FREE_ARRAY(int, chunk->wordOffsets, chunk->wordCount);
+    chunk->words = NULL;
+    chunk->wordOffsets = NULL;
+    chunk->wordCount = 0;
+
+    // 第一遍记录每条指令解码后的下标
+    int* index = ALLOCATE(int, chunk->count + 1);
+    int count = 0;
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        index[offset] = count;
+        count += wordLength(chunk, offset);
+    }
+    index[chunk->count] = count;
+
+    uint32_t* words = ALLOCATE(uint32_t, count);
+    int* offsets = ALLOCATE(int, count);
+    int next = 0;
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t* code = chunk->code + offset;
+        int length = instructionLength(chunk, offset);
+        int first = next;
+        switch (code[0]) {
+            case OP_JUMP: case OP_JUMP_LONG:
+            case OP_JUMP_IF_FALSE: case OP_JUMP_IF_FALSE_LONG:
+            case OP_JUMP_IF_TRUE: case OP_JUMP_IF_TRUE_LONG:
+            case OP_LOOP: case OP_LOOP_LONG: {
+                // 跳转目标换算成解码后的下标, 向后跳转与向前无异
+                uint8_t op = normalForm(code[0]);
+                int distance = op == code[0]
+                    ? (code[1] << 8) | code[2] : readLong(code + 1);
+                if (op == OP_LOOP) {
+                    op = OP_JUMP;
+                    distance = -distance;
+                }
+                words[next++] = op |
+                    (uint32_t)index[offset + length + distance] << 8;
+                break;
+            }
+            case OP_INLINE_GUARD:
+                words[next++] = code[0] | code[1] << 8 | code[2] << 16;
+                words[next++] = index[offset + 5 + ((code[3] << 8) | code[4])];
+                break;
+            case OP_CLOSURE:
+            case OP_CLOSURE_LONG:
+                // 每个上值的捕获方式与下标合成一个字
+                words[next++] = OP_CLOSURE |
+                    (uint32_t)constantOperand(chunk, offset) << 8;
+                for (int i = code[0] == OP_CLOSURE ? 2 : 4; i < length;
+                     i += 2) {
+                    words[next++] = code[i] | code[i + 1] << 8;
+                }
+                break;
+            default: {
+                // 短格式展开回一般形式 长格式的常量下标占满24位
+                // 其余指令至多两个字节操作数
+                if (normalForm(code[0]) != code[0]) {
+                    words[next++] = normalForm(code[0]) |
+                        (uint32_t)readLong(code + 1) << 8;
+                    break;
+                }
+                uint8_t operand = 0;
+                uint8_t op = expandShortForm(code[0], &operand);
+                uint32_t word = op;
+                if (op != code[0]) {
+                    word |= operand << 8;
+                }
+                for (int i = 1; i < length; i++) {
+                    word |= (uint32_t)code[i] << (8 * i);
+                }
+                words[next++] = word;
+                break;
+            }
+        }
+        for (int i = first; i < next; i++) {
+            offsets[i] = offset;
+        }
+        offset += length;
+    }
+
+    FREE_ARRAY(int, index, chunk->count + 1);
+    chunk->words = words;
+    chunk->wordOffsets = offsets;
+    chunk->wordCount = count;
 }
\ No newline at end of file
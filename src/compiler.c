@@ -1,11 +1,16 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "include/arena.h"
 #include "include/common.h"
 #include "include/compiler.h"
+#include "include/hash.h"
 #include "include/scanner.h"
 #include "include/memory.h"
+#include "include/number.h"
+#include "include/optimizer.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "include/debug.h"
@@ -48,13 +53,20 @@ typedef struct {
 typedef struct {
     Token name; // 局部变量名
     int depth; // 局部变量作用域深度
-    bool isCaptured; // 是否被捕获
+    bool isCaptured; // 是否被按引用捕获
+    bool capturedByValue; // 是否被按值捕获
+    bool assigned; // 初始化之后是否被赋值
+    bool isNumber; // 是否只会保存数字
+    bool fromLocal; // 是否因读取视为数字的局部变量而视为数字
+    int start; // 声明处的字节码偏移量
 } Local;
 
 // 上值结构体
 typedef struct {
     uint8_t index;
     bool isLocal;
+    bool byValue; // 捕获的变量从未被赋值时直接复制其值
+    Token name; // 延迟编译的函数体按变量名查找上值
 } Upvalue;
 
 // 函数类型
@@ -70,10 +82,16 @@ typedef struct Compiler{
     struct Compiler* enclosing;// 使用链表追踪嵌套函数
     ObjFunction* function;
     FunctionType type;
-    Local locals[UINT8_COUNT];
+    Local* locals; // UINT8_COUNT个 分配在编译器区域中
     int localCount; // 局部变量个数
-    Upvalue upvalues[UINT8_COUNT]; // 上值数组
+    Upvalue* upvalues; // 上值数组 UINT8_COUNT个
     int scopeDepth;
+    int inlinedBytes; // 已内联的代码量
+    // 常量表的哈希索引(开放寻址): 槽中存常量下标, -1表示空
+    int* constantSlots;
+    int constantCapacity;
+    int constantFill;
+    ArenaMark mark; // 开始编译时区域的分配位置 结束时归还其后的全部空间
 } Compiler;
 
 // 编译类结构体(提供最近邻外层的类信息)
@@ -83,6 +101,9 @@ typedef struct ClassCompiler {
 } ClassCompiler;
 
 Parser parser;
+CompileOptions compileOptions = {0};
+// 编译器内部数据(局部变量、上值与常量索引)所在的区域
+Arena compilerArena = {NULL, NULL};
 Compiler* current = NULL;
 ClassCompiler* currentClass = NULL;
 
@@ -98,6 +119,42 @@ int innermostLoopScopeDepth = 0;
 
 BreakJump* breakJumps = NULL;
 
+// 当前中缀运算符左操作数的起始偏移量(由parsePrecedence设置)
+int operandStart = 0;
+// 左操作数开始时常量表的大小 常量去重后操作数未必新增常量
+int operandConstants = 0;
+// 最近一条作用于布尔结果的OP_NOT的偏移量(!=、<=、>=)
+int boolNotOffset = -1;
+
+// 表达式的静态类型: 两侧操作数都能证明是数字时生成免检查的数值指令
+typedef enum {
+    EXPR_ANY,
+    EXPR_NUMBER,       // 必为数字
+    EXPR_LOCAL_NUMBER  // 由视为数字的局部变量得出, 该变量不再视为数字后随之失效
+} ExprType;
+
+#define IS_NUMERIC(type) ((type) != EXPR_ANY)
+
+// 最近编译完成的表达式的类型(由各解析函数设置)
+ExprType exprType = EXPR_ANY;
+
+// 常量折叠生成的字符串长度上限
+#define FOLD_STRING_MAX 1024
+
+// 内联预算: 被调用函数体的字节数、参数个数、每个函数内联代码的总量
+#define INLINE_MAX_BYTES 32
+#define INLINE_MAX_ARITY 16
+#define INLINE_FUNCTION_BUDGET 1024
+
+// 可内联的全局函数
+typedef struct {
+    ObjString* name;
+    ObjFunction* function;
+} InlineCandidate;
+
+InlineCandidate inlineCandidates[UINT8_COUNT];
+int inlineCandidateCount = 0;
+
 // 当前程序块
 static Chunk* currentChunk() {
     return &current->function->chunk;
@@ -107,6 +164,7 @@ static Chunk* currentChunk() {
 static void errorAt(Token* token, const char* message) {
     if (parser.panicMode) return;
     parser.panicMode = true;
+    flushOutput();
     fprintf(stderr, "[line %d] Error ", token->line);
 
     if (token->type == TOKEN_EOF) {
@@ -175,23 +233,31 @@ static void emitBytes(uint8_t byte1, uint8_t byte2) {
     emitByte(byte2);
 }
 
-// 循环指令
+// 循环指令 偏移量超出16位时改用长格式
 static void emitLoop(int loopStart) {
-    emitByte(OP_LOOP);
-
-    int offset = currentChunk()->count - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body too large.");
+    int offset = currentChunk()->count - loopStart + 3;
+    if (offset <= UINT16_MAX) {
+        emitByte(OP_LOOP);
+        emitByte((offset >> 8) & 0xff);
+        emitByte(offset & 0xff);
+        return;
+    }
 
+    offset++;
+    if (offset > UINT24_MAX) error("Loop body too large.");
+    emitByte(OP_LOOP_LONG);
+    emitByte((offset >> 16) & 0xff);
     emitByte((offset >> 8) & 0xff);
     emitByte(offset & 0xff);
 }
 
-// 写入跳转占位符
+// 写入跳转占位符: 写入时还不知道跳多远, 一律用长格式, 由窥孔优化改回一般格式
 static int emitJump(uint8_t instruction) {
-    emitByte(instruction);
+    emitByte(longForm(instruction));
+    emitByte(0xff);
     emitByte(0xff);
     emitByte(0xff);
-    return currentChunk()->count - 2;
+    return currentChunk()->count - 3;
 }
 
 // 退出块
@@ -204,33 +270,131 @@ static void emitReturn() {
     emitByte(OP_RETURN);
 }
 
-// 确保常量数量不大于256
-static uint8_t makeConstant(Value value) {
+// 常量按位比较(区分0与-0) 对象按同一性比较(编译期的字符串都已驻留)
+static bool sameConstant(Value a, Value b) {
+    if (IS_NUMBER(a) || IS_NUMBER(b)) {
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    if (IS_OBJ(a) || IS_OBJ(b)) {
+        return IS_OBJ(a) && IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b);
+    }
+    return valuesEqual(a, b);
+}
+
+static uint32_t hashConstant(Value value) {
+    uint64_t bits = 0;
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(bits));
+    } else if (IS_OBJ(value)) {
+        bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+    } else if (IS_BOOL(value)) {
+        bits = AS_BOOL(value) ? 2 : 1;
+    }
+    return (uint32_t)hashBytes(&bits, sizeof(bits), HASH_SEED);
+}
+
+/*
+ * 在常量索引中查找value, 返回其所在的槽或应写入的空槽;
+ * 撤销的常量(discardOperands)留下的槽下标越界或指向别的值, 查找时跳过
+ */
+static int* constantSlot(Compiler* compiler, Value value) {
+    ValueArray* constants = &compiler->function->chunk.constants;
+    int mask = compiler->constantCapacity - 1;
+    for (int i = (int)(hashConstant(value) & mask);; i = (i + 1) & mask) {
+        int* slot = &compiler->constantSlots[i];
+        if (*slot == -1) return slot;
+        if (*slot < constants->count &&
+            sameConstant(constants->values[*slot], value)) {
+            return slot;
+        }
+    }
+}
+
+// 索引装载率超过3/4时扩容 按常量表重建
+static void growConstantIndex(Compiler* compiler) {
+    int capacity = compiler->constantCapacity < 16
+        ? 16 : compiler->constantCapacity * 2;
+    compiler->constantSlots = (int*)arenaAlloc(&compilerArena,
+                                               sizeof(int) * capacity);
+    compiler->constantCapacity = capacity;
+    compiler->constantFill = 0;
+    for (int i = 0; i < capacity; i++) compiler->constantSlots[i] = -1;
+
+    ValueArray* constants = &compiler->function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        int* slot = constantSlot(compiler, constants->values[i]);
+        if (*slot != -1) continue;
+        *slot = i;
+        compiler->constantFill++;
+    }
+}
+
+// 同一函数中相同的常量只占一个下标 超过一字节时由长格式指令引用
+static int makeConstant(Value value) {
+    if ((current->constantFill + 1) * 4 > current->constantCapacity * 3) {
+        growConstantIndex(current);
+    }
+    int* slot = constantSlot(current, value);
+    if (*slot != -1) return *slot;
+
     int constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX) {
+    if (constant > UINT24_MAX) {
         error("Too many constants in one chunk.");
         return 0;
     }
+    *slot = constant;
+    current->constantFill++;
+    return constant;
+}
 
-    return (uint8_t)constant;
+// 引用常量的指令 下标超过一字节时换成长格式
+static void emitConstantOp(uint8_t op, int constant) {
+    if (constant <= UINT8_MAX) {
+        emitBytes(op, (uint8_t)constant);
+        return;
+    }
+    emitByte(longForm(op));
+    emitByte((constant >> 16) & 0xff);
+    emitByte((constant >> 8) & 0xff);
+    emitByte(constant & 0xff);
 }
 
 // 处理常量
 static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    // 小整数直接编码在指令中 不占常量表(-0除外)
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        if (number >= INT8_MIN && number <= INT8_MAX &&
+            number == (int8_t)number && !(number == 0 && signbit(number))) {
+            emitBytes(OP_SMALL_INT, (uint8_t)(int8_t)number);
+            return;
+        }
+    }
+    emitConstantOp(OP_CONSTANT, makeConstant(value));
 }
 
-// 计算真实偏移量
-static void patchJump(int offset) {
-    // jump 指令占两字节
-    int jump = currentChunk()->count - offset - 2;
+// 把跳到当前位置的偏移量写入offset处width字节宽的占位符
+static void patchOffset(int offset, int width) {
+    int jump = currentChunk()->count - offset - width;
 
-    if (jump > UINT16_MAX) {
+    if (jump > (width == 2 ? UINT16_MAX : UINT24_MAX)) {
         error("Too much code to jump over.");
     }
 
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+    for (int i = width - 1; i >= 0; i--) {
+        currentChunk()->code[offset + i] = jump & 0xff;
+        jump >>= 8;
+    }
+    boolNotOffset = -1; // 跳转目标之前的指令不能再删除
+}
+
+// 计算真实偏移量 emitJump写入的占位符占三字节
+static void patchJump(int offset) {
+    patchOffset(offset, 3);
 }
 
 static void patchBreakJumps() {
@@ -247,23 +411,39 @@ static void patchBreakJumps() {
     }
 }
 
-// 初始化编译器
-static void initCompiler(Compiler* compiler, FunctionType type) {
+// 初始化编译器 function非NULL时编译延迟编译的函数体
+static void initCompiler(Compiler* compiler, FunctionType type,
+                         ObjFunction* function) {
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    compiler->function = newFunction();
+    compiler->inlinedBytes = 0;
+    compiler->mark = arenaMark(&compilerArena);
+    compiler->locals = (Local*)arenaAlloc(&compilerArena,
+                                          sizeof(Local) * UINT8_COUNT);
+    compiler->upvalues = (Upvalue*)arenaAlloc(&compilerArena,
+                                              sizeof(Upvalue) * UINT8_COUNT);
+    compiler->constantSlots = NULL;
+    compiler->constantCapacity = 0;
+    compiler->constantFill = 0;
+    compiler->function = function != NULL ? function : newFunction();
     current = compiler;
+    boolNotOffset = -1;
     // 堆存储函数名
-    if (type != TYPE_SCRIPT) {
+    if (type != TYPE_SCRIPT && function == NULL) {
         current->function->name = copyString(parser.previous.start,
                                              parser.previous.length);
     }
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
+    local->capturedByValue = false;
+    local->assigned = false;
+    local->isNumber = false;
+    local->fromLocal = false;
+    local->start = 0;
     // 函数调用：存储调用函数
     // 方法调用：存储接收器
     if (type != TYPE_FUNCTION) {
@@ -279,13 +459,26 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 static ObjFunction* endCompiler() {
     emitReturn();
     ObjFunction* function = current->function;
+    int size = currentChunk()->count;
+    if (!parser.hadError) {
+        optimizeChunk(currentChunk(), compileOptions.optimizeLevel,
+                      compileOptions.repl, compileOptions.registers);
+    }
     #ifdef DEBUG_PRINT_CODE
         if (!parser.hadError) {
-            disassembleChunk(currentChunk(), function->name != NULL
-                ? function->name->chars : "<script>");
+            const char* name = function->name != NULL
+                ? function->name->chars : "<script>";
+            printf("peephole %s: %d -> %d bytes, saved %d\n", name, size,
+                   currentChunk()->count, size - currentChunk()->count);
+            disassembleChunk(currentChunk(), name);
         }
+    #else
+        (void)size;
     #endif
+    packChunk(currentChunk());
+    arenaRelease(&compilerArena, current->mark);
     current = current->enclosing;
+    boolNotOffset = -1;
     return function;
 }
 
@@ -318,7 +511,7 @@ static void parsePrecedence(Precedence precedence);
 static ParseRule* getRule(TokenType type);
 
 // 将变量名存入常量表并返回索引
-static uint8_t identifierConstant(Token* name) {
+static int identifierConstant(Token* name) {
     return makeConstant(OBJ_VAL(copyString(name->start,
                                            name->length)));
 }
@@ -346,7 +539,7 @@ static int resolveLocal(Compiler* compiler, Token* name) {
 
 // 向上值数组添加被闭包函数引用的值
 static int addUpvalue(Compiler* compiler, uint8_t index,
-                      bool isLocal) {
+                      bool isLocal, bool byValue) {
     int upvalueCount = compiler->function->upvalueCount;
     for (int i = 0; i < upvalueCount; i++) {
         Upvalue* upvalue = &compiler->upvalues[i];
@@ -362,25 +555,133 @@ static int addUpvalue(Compiler* compiler, uint8_t index,
 
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
+    compiler->upvalues[upvalueCount].byValue = byValue;
     return compiler->function->upvalueCount++;
 }
 
 // 查找闭包引用值
 static int resolveUpvalue(Compiler* compiler, Token* name) {
-    if (compiler->enclosing == NULL) return -1;
+    if (compiler->enclosing == NULL) {
+        // 延迟编译的函数体: 外层编译器已不存在, 按声明时记下的变量名查找
+        for (int i = 0; i < compiler->function->upvalueCount; i++) {
+            if (identifiersEqual(name, &compiler->upvalues[i].name)) return i;
+        }
+        return -1;
+    }
 
     int local = resolveLocal(compiler->enclosing, name);
     if (local != -1){
-        compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true);
+        // 尚未被赋值的变量先按值捕获 之后出现赋值时再改回按引用
+        Local* captured = &compiler->enclosing->locals[local];
+        if (captured->assigned) {
+            captured->isCaptured = true;
+        } else {
+            captured->capturedByValue = true;
+        }
+        return addUpvalue(compiler, (uint8_t)local, true,
+                          !captured->assigned);
     }
     int upvalue = resolveUpvalue(compiler->enclosing, name);
     if (upvalue != -1) {
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(compiler, (uint8_t)upvalue, false,
+                          compiler->enclosing->upvalues[upvalue].byValue);
     }
     return -1;
 }
 
+/*
+ * 把chunk中对局部变量(isLocal)或上值index的按值捕获改回按引用捕获,
+ * 内层函数已编译完成, 就地改写它读取该上值的指令并递归处理更内层的闭包
+ */
+static void demoteCaptures(Chunk* chunk, uint8_t index, bool isLocal) {
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        uint8_t op = chunk->code[offset];
+        if (op == OP_GET_CAPTURED && !isLocal &&
+            chunk->code[offset + 1] == index) {
+            chunk->code[offset] = OP_GET_UPVALUE;
+        }
+        if (op != OP_CLOSURE && op != OP_CLOSURE_LONG) continue;
+
+        ObjFunction* function = AS_FUNCTION(
+            chunk->constants.values[constantOperand(chunk, offset)]);
+        int captures = offset + (op == OP_CLOSURE ? 2 : 4);
+        for (int i = 0; i < function->upvalueCount; i++) {
+            uint8_t* kind = &chunk->code[captures + i * 2];
+            if (chunk->code[captures + 1 + i * 2] != index) continue;
+            if (isLocal && *kind == CAPTURE_LOCAL_VALUE) {
+                *kind = CAPTURE_LOCAL;
+            } else if (!isLocal && *kind == CAPTURE_UPVALUE_VALUE) {
+                *kind = CAPTURE_UPVALUE;
+            } else {
+                continue;
+            }
+            demoteCaptures(&function->chunk, (uint8_t)i, false);
+        }
+    }
+}
+
+// 免检查的数值指令对应的普通指令
+static uint8_t checkedOp(uint8_t op) {
+    switch (op) {
+        case OP_ADD_NUMBER:      return OP_ADD;
+        case OP_SUBTRACT_NUMBER: return OP_SUBTRACT;
+        case OP_MULTIPLY_NUMBER: return OP_MULTIPLY;
+        case OP_DIVIDE_NUMBER:   return OP_DIVIDE;
+        case OP_NEGATE_NUMBER:   return OP_NEGATE;
+        case OP_GREATER_NUMBER:  return OP_GREATER;
+        case OP_LESS_NUMBER:     return OP_LESS;
+        default:                 return op;
+    }
+}
+
+/*
+ * 局部变量可能被赋予非数字: 声明之后生成的免检查数值指令都可能依赖它,
+ * 全部改回带类型检查的指令(函数尚未编译完成, 偏移量仍然有效)。
+ * 从局部变量复制或算出数字的变量(如循环中先执行的b = a)同样可能
+ * 得到非数字, 不区分来源一并遗忘
+ */
+static void forgetNumber(Compiler* compiler, int slot) {
+    Local* local = &compiler->locals[slot];
+    if (!local->isNumber) return;
+    local->isNumber = false;
+    Chunk* chunk = &compiler->function->chunk;
+    for (int offset = local->start; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        chunk->code[offset] = checkedOp(chunk->code[offset]);
+    }
+    for (int i = 0; i < compiler->localCount; i++) {
+        if (compiler->locals[i].fromLocal) forgetNumber(compiler, i);
+    }
+}
+
+// 局部变量被赋值: 此前的按值捕获全部改回按引用
+static void assignLocal(Compiler* compiler, int slot) {
+    Local* local = &compiler->locals[slot];
+    local->assigned = true;
+    if (!local->capturedByValue) return;
+    local->capturedByValue = false;
+    local->isCaptured = true;
+    demoteCaptures(&compiler->function->chunk, (uint8_t)slot, true);
+}
+
+// 经由上值赋值: 沿上值链找到变量所在的函数, 链上每一层都改回按引用
+static void assignUpvalue(Compiler* compiler, int index) {
+    // 延迟编译的函数体: 声明时已按会被赋值处理
+    if (compiler->enclosing == NULL) return;
+    Upvalue* upvalue = &compiler->upvalues[index];
+    if (upvalue->isLocal) {
+        // 内层函数赋予的值类型未知
+        assignLocal(compiler->enclosing, upvalue->index);
+        forgetNumber(compiler->enclosing, upvalue->index);
+    } else {
+        assignUpvalue(compiler->enclosing, upvalue->index);
+    }
+    if (!upvalue->byValue) return;
+    upvalue->byValue = false;
+    demoteCaptures(&compiler->function->chunk, (uint8_t)index, false);
+}
+
 // 存储局部变量及该变量的作用域深度
 static void addLocal(Token name) {
     if (current->localCount == UINT8_COUNT) {
@@ -391,6 +692,11 @@ static void addLocal(Token name) {
     local->name = name;
     local->depth = -1; // 默认表示变量未定义
     local->isCaptured = false;
+    local->capturedByValue = false;
+    local->assigned = false;
+    local->isNumber = false;
+    local->fromLocal = false;
+    local->start = currentChunk()->count;
 }
 
 // 记录局部变量并检查变量是否重叠
@@ -413,7 +719,7 @@ static void declareVariable() {
 }
 
 // 分析变量
-static uint8_t parseVariable(const char* errorMessage) {
+static int parseVariable(const char* errorMessage) {
     consume(TOKEN_IDENTIFIER, errorMessage);
     declareVariable();
     if (current->scopeDepth > 0) return 0;
@@ -428,12 +734,12 @@ static void markInitialized() {
 }
 
 // 定义全局变量
-static void defineVariable(uint8_t global) {
+static void defineVariable(int global) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
     }
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitConstantOp(OP_DEFINE_GLOBAL, global);
 }
 
 // 函数参数列表
@@ -459,51 +765,435 @@ static void and_(bool canAssign) {
     emitByte(OP_POP);
     parsePrecedence(PREC_AND);
     patchJump(endJump);
+    exprType = EXPR_ANY;
+}
+
+// [start, end) 恰好是一条压入常量的指令时取出该常量
+static bool constantIn(int start, int end, Value* value) {
+    Chunk* chunk = currentChunk();
+    if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[start + 1]];
+        return true;
+    }
+    if (end - start == 2 && chunk->code[start] == OP_SMALL_INT) {
+        *value = NUMBER_VAL((int8_t)chunk->code[start + 1]);
+        return true;
+    }
+    if (end - start != 1) return false;
+    switch (chunk->code[start]) {
+        case OP_NIL:   *value = NIL_VAL; return true;
+        case OP_TRUE:  *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        default: return false;
+    }
+}
+
+/*
+ * 撤销从start开始的常量指令, 此后新增的常量(从下标constants起)一并丢弃;
+ * 操作数复用的已有常量不受影响
+ */
+static void discardOperands(int start, int constants) {
+    Chunk* chunk = currentChunk();
+    chunk->constants.count = constants;
+    chunk->count = start;
+}
+
+// 压入折叠结果
+static void emitValue(Value value) {
+    if (IS_NIL(value)) {
+        emitByte(OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(value);
+    }
+    exprType = IS_NUMBER(value) ? EXPR_NUMBER : EXPR_ANY;
+}
+
+// 编译期字符串拼接 字面量与折叠结果都是平坦字符串
+static Value foldConcatenate(ObjString* a, ObjString* b) {
+    int length = a->length + b->length;
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+    return OBJ_VAL(takeString(chars, length));
+}
+
+// 编译期字符串重复 与运行时相同, 次数取整数部分
+static bool foldRepeat(ObjString* string, double count, Value* result) {
+    if (!(count >= 0 && count * string->length <= FOLD_STRING_MAX)) {
+        return false;
+    }
+    int times = (int)count;
+    int length = string->length * times;
+    char* chars = ALLOCATE(char, length + 1);
+    for (int i = 0; i < times; i++) {
+        memcpy(chars + string->length * i, string->chars, string->length);
+    }
+    chars[length] = '\0';
+    *result = OBJ_VAL(takeString(chars, length));
+    return true;
+}
+
+// 两个常量操作数的折叠 结果与运行时一致; 运行时会报错的组合不折叠
+static bool foldBinary(TokenType operatorType, Value a, Value b,
+                       Value* result) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        switch (operatorType) {
+            case TOKEN_PLUS:  *result = NUMBER_VAL(x + y); return true;
+            case TOKEN_MINUS: *result = NUMBER_VAL(x - y); return true;
+            case TOKEN_STAR:  *result = NUMBER_VAL(x * y); return true;
+            case TOKEN_SLASH: *result = NUMBER_VAL(x / y); return true;
+            // 与运行时相同: <= 即 !(x > y), >= 即 !(x < y)
+            case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+            case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+            case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+            case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+            default: break;
+        }
+    }
+
+    switch (operatorType) {
+        case TOKEN_EQUAL_EQUAL:
+            *result = BOOL_VAL(valuesEqual(a, b));
+            return true;
+        case TOKEN_BANG_EQUAL:
+            *result = BOOL_VAL(!valuesEqual(a, b));
+            return true;
+        case TOKEN_PLUS:
+            if (!IS_STRING(a) || !IS_STRING(b)) return false;
+            *result = foldConcatenate(AS_STRING(a), AS_STRING(b));
+            return true;
+        case TOKEN_STAR:
+            if (IS_STRING(a) && IS_NUMBER(b)) {
+                return foldRepeat(AS_STRING(a), AS_NUMBER(b), result);
+            }
+            if (IS_NUMBER(a) && IS_STRING(b)) {
+                return foldRepeat(AS_STRING(b), AS_NUMBER(a), result);
+            }
+            return false;
+        default:
+            return false;
+    }
 }
 
 // 加减乘除等中缀操作符解析函数
 static void binary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
     ParseRule* rule = getRule(operatorType);
+    int leftStart = operandStart;
+    int leftConstants = operandConstants;
+    int rightStart = currentChunk()->count;
+    ExprType leftType = exprType;
     parsePrecedence((Precedence)(rule->precedence + 1));
+    bool numbers = IS_NUMERIC(leftType) && IS_NUMERIC(exprType);
+
+    // 两侧都是常量时在编译期求值
+    Value a, b, result;
+    if (constantIn(leftStart, rightStart, &a) &&
+        constantIn(rightStart, currentChunk()->count, &b) &&
+        foldBinary(operatorType, a, b, &result)) {
+        // 结果尚未进入常量表, 撤销操作数时不能触发分配
+        discardOperands(leftStart, leftConstants);
+        emitValue(result);
+        return;
+    }
 
+    uint8_t greater = numbers ? OP_GREATER_NUMBER : OP_GREATER;
+    uint8_t less = numbers ? OP_LESS_NUMBER : OP_LESS;
     switch (operatorType) {
-        case TOKEN_PLUS:          emitByte(OP_ADD); break;
-        case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+        case TOKEN_PLUS:
+            emitByte(numbers ? OP_ADD_NUMBER : OP_ADD);
+            break;
+        case TOKEN_MINUS:
+            emitByte(numbers ? OP_SUBTRACT_NUMBER : OP_SUBTRACT);
+            break;
+        case TOKEN_STAR:
+            emitByte(numbers ? OP_MULTIPLY_NUMBER : OP_MULTIPLY);
+            break;
+        case TOKEN_SLASH:
+            emitByte(numbers ? OP_DIVIDE_NUMBER : OP_DIVIDE);
+            break;
         case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
         case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
+        case TOKEN_GREATER:       emitByte(greater); break;
+        case TOKEN_GREATER_EQUAL: emitBytes(less, OP_NOT); break;
+        case TOKEN_LESS:          emitByte(less); break;
+        case TOKEN_LESS_EQUAL:    emitBytes(greater, OP_NOT); break;
         default: return;
     }
+    // 减法与除法只在操作数都是数字时成功 结果必为数字;
+    // 加法与乘法也可作用于字符串, 比较与相等的结果是布尔值
+    switch (operatorType) {
+        case TOKEN_MINUS:
+        case TOKEN_SLASH:
+            exprType = EXPR_NUMBER;
+            break;
+        case TOKEN_PLUS:
+        case TOKEN_STAR:
+            if (!numbers) {
+                exprType = EXPR_ANY;
+            } else if (leftType == EXPR_LOCAL_NUMBER) {
+                exprType = EXPR_LOCAL_NUMBER;
+            }
+            break;
+        default:
+            exprType = EXPR_ANY;
+            break;
+    }
+    if (operatorType == TOKEN_BANG_EQUAL ||
+        operatorType == TOKEN_GREATER_EQUAL ||
+        operatorType == TOKEN_LESS_EQUAL) {
+        boolNotOffset = currentChunk()->count - 1;
+    }
+}
+
+// 被调用者恰好是读取一个可内联的全局函数时返回该函数
+static ObjFunction* inlineCandidate(int calleeStart) {
+    Chunk* chunk = currentChunk();
+    if (compileOptions.optimizeLevel == 0 ||
+        chunk->count - calleeStart != 2 ||
+        chunk->code[calleeStart] != OP_GET_GLOBAL) {
+        return NULL;
+    }
+    ObjString* name = AS_STRING(
+        chunk->constants.values[chunk->code[calleeStart + 1]]);
+    for (int i = inlineCandidateCount - 1; i >= 0; i--) {
+        if (inlineCandidates[i].name == name) {
+            return inlineCandidates[i].function;
+        }
+    }
+    return NULL;
+}
+
+// 槽位是参数(0号槽是被调用者自身)
+static bool parameterSlot(ObjFunction* function, uint8_t slot) {
+    return slot != 0 && slot <= function->arity;
+}
+
+/*
+ * 函数体只含一个return表达式: 直线代码, 只读参数, 不捕获变量
+ * -R下函数体在登记前已融合, 读取参数的融合指令同样可以内联
+ */
+static bool inlinable(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    if (function->upvalueCount > 0 || function->arity > INLINE_MAX_ARITY ||
+        chunk->count - 1 > INLINE_MAX_BYTES) {
+        return false;
+    }
+    // 函数体执行到RETURN时栈上必须恰好只有返回值 (局部变量会破坏SLIDE)
+    int depth = 0;
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        uint8_t operand = offset + 1 < chunk->count
+            ? chunk->code[offset + 1] : 0;
+        switch (expandShortForm(chunk->code[offset], &operand)) {
+            case OP_RETURN:
+                return offset == chunk->count - 1 && depth == 1;
+            case OP_GET_LOCAL:
+                if (!parameterSlot(function, operand)) return false;
+                depth++;
+                break;
+            case OP_GET_LOCAL_PAIR:
+                if (!parameterSlot(function, operand) ||
+                    !parameterSlot(function, chunk->code[offset + 2])) {
+                    return false;
+                }
+                depth += 2;
+                break;
+            case OP_GET_LOCAL_CONSTANT:
+                if (!parameterSlot(function, operand)) return false;
+                depth += 2;
+                break;
+            case OP_CONSTANT: case OP_SMALL_INT:
+            case OP_NIL: case OP_TRUE: case OP_FALSE:
+            case OP_GET_GLOBAL:
+                depth++;
+                break;
+            case OP_GET_PROPERTY: case OP_NOT: case OP_NEGATE:
+                break;
+            case OP_EQUAL: case OP_GREATER: case OP_LESS:
+            case OP_NOT_EQUAL: case OP_NOT_GREATER: case OP_NOT_LESS:
+            case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE:
+                depth--;
+                break;
+            case OP_CALL:
+                depth -= operand;
+                break;
+            case OP_INVOKE:
+                depth -= chunk->code[offset + 2];
+                break;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+// 登记顶层声明的函数 同名函数后声明的覆盖先声明的
+static void registerInline(ObjString* name, ObjFunction* function) {
+    for (int i = 0; i < inlineCandidateCount; i++) {
+        if (inlineCandidates[i].name == name) {
+            inlineCandidates[i].function = inlinable(function) ? function : NULL;
+            return;
+        }
+    }
+    if (!inlinable(function) || inlineCandidateCount == UINT8_COUNT) return;
+    inlineCandidates[inlineCandidateCount].name = name;
+    inlineCandidates[inlineCandidateCount].function = function;
+    inlineCandidateCount++;
+}
+
+/*
+ * 在调用处展开函数体, 栈上已有被调用者与参数:
+ *     OP_INLINE_GUARD f argc -> slow   全局绑定已被改写时走普通调用
+ *     <函数体, 参数读取改为OP_PICK>
+ *     OP_SLIDE argc+1                   用返回值替换被调用者与参数
+ *     OP_JUMP -> end
+ * slow:
+ *     OP_CALL argc
+ * end:
+ */
+static bool inlineCall(ObjFunction* function, uint8_t argCount) {
+    Chunk* callee = &function->chunk;
+    int bodySize = callee->count - 1;
+    if (argCount != function->arity ||
+        current->inlinedBytes + bodySize > INLINE_FUNCTION_BUDGET) {
+        return false;
+    }
+    // 函数体里的常量要复制进当前常量表 不能因此超出上限
+    int constants = 1;
+    for (int offset = 0; offset < bodySize;
+         offset += instructionLength(callee, offset)) {
+        switch (callee->code[offset]) {
+            case OP_CONSTANT: case OP_GET_GLOBAL:
+            case OP_GET_PROPERTY: case OP_INVOKE:
+            case OP_GET_LOCAL_CONSTANT:
+                constants++;
+                break;
+            default:
+                break;
+        }
+    }
+    if (currentChunk()->constants.count + constants > UINT8_COUNT) {
+        return false;
+    }
+
+    emitBytes(OP_INLINE_GUARD, (uint8_t)makeConstant(OBJ_VAL(function)));
+    emitBytes(argCount, 0xff);
+    emitByte(0xff);
+    int guard = currentChunk()->count - 2;
+
+    // 参数在栈上的深度 = 参数个数 - 槽号 + 函数体已压入的临时值
+    int depth = 0;
+    for (int offset = 0; offset < bodySize;
+         offset += instructionLength(callee, offset)) {
+        uint8_t operand = callee->code[offset + 1];
+        uint8_t op = expandShortForm(callee->code[offset], &operand);
+        switch (op) {
+            case OP_GET_LOCAL:
+                emitBytes(OP_PICK, argCount - operand + depth);
+                depth++;
+                break;
+            case OP_GET_LOCAL_PAIR:
+                // 融合指令拆回两次读取
+                emitBytes(OP_PICK, argCount - operand + depth);
+                depth++;
+                emitBytes(OP_PICK, argCount - callee->code[offset + 2] + depth);
+                depth++;
+                break;
+            case OP_GET_LOCAL_CONSTANT:
+                emitBytes(OP_PICK, argCount - operand + depth);
+                depth++;
+                emitBytes(OP_CONSTANT, makeConstant(
+                    callee->constants.values[callee->code[offset + 2]]));
+                depth++;
+                break;
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+                emitBytes(op, makeConstant(callee->constants.values[operand]));
+                depth++;
+                break;
+            case OP_GET_PROPERTY:
+                emitBytes(op, makeConstant(callee->constants.values[operand]));
+                break;
+            case OP_INVOKE:
+                emitBytes(op, makeConstant(callee->constants.values[operand]));
+                emitByte(callee->code[offset + 2]);
+                depth -= callee->code[offset + 2];
+                break;
+            case OP_CALL:
+                emitBytes(op, operand);
+                depth -= operand;
+                break;
+            case OP_SMALL_INT:
+                emitBytes(op, operand);
+                depth++;
+                break;
+            case OP_NIL: case OP_TRUE: case OP_FALSE:
+                emitByte(op);
+                depth++;
+                break;
+            case OP_NOT: case OP_NEGATE:
+                emitByte(op);
+                break;
+            default:
+                // 二元运算
+                emitByte(op);
+                depth--;
+                break;
+        }
+    }
+
+    emitBytes(OP_SLIDE, argCount + 1);
+    int end = emitJump(OP_JUMP);
+    patchOffset(guard, 2);
+    emitBytes(OP_CALL, argCount);
+    patchJump(end);
+    current->inlinedBytes += bodySize;
+
+#ifdef DEBUG_PRINT_CODE
+    printf("inline %s at line %d: %d bytes\n", function->name->chars,
+           parser.previous.line, bodySize);
+#endif
+    return true;
 }
 
 // 函数调用
 static void call(bool canAssign) {
+    ObjFunction* inlined = inlineCandidate(operandStart);
     uint8_t argCount = argumentList();
+    exprType = EXPR_ANY;
+    if (inlined != NULL && inlineCall(inlined, argCount)) return;
     emitBytes(OP_CALL, argCount);
 }
 
 // .访问实例的属性
 static void dot(bool canAssign) {
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
+    int name = identifierConstant(&parser.previous);
 
     // 优先级判断避免混淆 (a+b.c=3)
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitConstantOp(OP_SET_PROPERTY, name);
     } else if (match(TOKEN_LEFT_PAREN)) {
-        uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
-        emitByte(argCount);
+        if (name > UINT8_MAX) {
+            // OP_INVOKE没有长格式: 先取属性再调用
+            emitConstantOp(OP_GET_PROPERTY, name);
+            emitBytes(OP_CALL, argumentList());
+        } else {
+            uint8_t argCount = argumentList();
+            emitBytes(OP_INVOKE, (uint8_t)name);
+            emitByte(argCount);
+        }
     } else {
-        emitBytes(OP_GET_PROPERTY, name);
+        emitConstantOp(OP_GET_PROPERTY, name);
     }
+    exprType = EXPR_ANY;
 }
 
 // 布尔值解析
@@ -524,8 +1214,9 @@ static void grouping(bool canAssign) {
 
 // 处理数字
 static void number(bool canAssign) {
-    double value = strtod(parser.previous.start, NULL);
+    double value = parseNumber(parser.previous.start, parser.previous.length);
     emitConstant(NUMBER_VAL(value));
+    exprType = EXPR_NUMBER;
 }
 
 // or: 或运算
@@ -538,6 +1229,7 @@ static void or_(bool canAssign) {
 
     parsePrecedence(PREC_OR);
     patchJump(endJump);
+    exprType = EXPR_ANY;
 }
 
 // 处理字符 去除两端引号
@@ -554,7 +1246,8 @@ static void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     } else if ((arg = resolveUpvalue(current, &name)) != -1){
-        getOp = OP_GET_UPVALUE;
+        getOp = current->upvalues[arg].byValue
+            ? OP_GET_CAPTURED : OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
         arg = identifierConstant(&name);
@@ -563,10 +1256,22 @@ static void namedVariable(Token name, bool canAssign) {
     }
 
     if (canAssign && match(TOKEN_EQUAL)) {
+        if (setOp == OP_SET_LOCAL) {
+            assignLocal(current, arg);
+        } else if (setOp == OP_SET_UPVALUE) {
+            assignUpvalue(current, arg);
+        }
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        if (setOp == OP_SET_LOCAL && !IS_NUMERIC(exprType)) {
+            forgetNumber(current, arg);
+        } else if (setOp == OP_SET_LOCAL && exprType == EXPR_LOCAL_NUMBER) {
+            current->locals[arg].fromLocal = true;
+        }
+        emitConstantOp(setOp, arg);
     } else {
-        emitBytes(getOp, (uint8_t)arg);
+        emitConstantOp(getOp, arg);
+        exprType = getOp == OP_GET_LOCAL && current->locals[arg].isNumber
+            ? EXPR_LOCAL_NUMBER : EXPR_ANY;
     }
 }
 
@@ -593,16 +1298,20 @@ static void super_(bool canAssign) {
     // super.method
     consume(TOKEN_DOT, "Expect '.' after 'super'.");
     consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous); // 存储方法名
+    int name = identifierConstant(&parser.previous); // 存储方法名
     namedVariable(syntheticToken("this"), false); // 压this当前对象入栈
-    if (match(TOKEN_LEFT_PAREN)) { // 寻找带参数列表的调用
+    if (match(TOKEN_LEFT_PAREN) && name <= UINT8_MAX) { // 寻找带参数列表的调用
         uint8_t argcount = argumentList();
         namedVariable(syntheticToken("super"), false); // 压入super父类引用入栈
-        emitBytes(OP_SUPER_INVOKE, name); // 类方法快速调用
+        emitBytes(OP_SUPER_INVOKE, (uint8_t)name); // 类方法快速调用
         emitByte(argcount);
     } else {
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_GET_SUPER, name);
+        emitConstantOp(OP_GET_SUPER, name);
+        // OP_SUPER_INVOKE没有长格式: 先绑定方法再调用
+        if (parser.previous.type == TOKEN_LEFT_PAREN) {
+            emitBytes(OP_CALL, argumentList());
+        }
     }
 }
 
@@ -618,11 +1327,44 @@ static void this_(bool canAssign) {
 // 前缀运算符处理
 static void unary(bool canAssign) {
     TokenType operateType = parser.previous.type;
+    int start = currentChunk()->count;
+    int constants = currentChunk()->constants.count;
 
     parsePrecedence(PREC_UNARY);
+    bool numeric = IS_NUMERIC(exprType);
+
+    Value value;
+    if (constantIn(start, currentChunk()->count, &value)) {
+        if (operateType == TOKEN_BANG) {
+            discardOperands(start, constants);
+            emitValue(BOOL_VAL(IS_NIL(value) ||
+                               (IS_BOOL(value) && !AS_BOOL(value))));
+            return;
+        }
+        if (operateType == TOKEN_MINUS && IS_NUMBER(value)) {
+            discardOperands(start, constants);
+            emitValue(NUMBER_VAL(-AS_NUMBER(value)));
+            return;
+        }
+    }
+    // !(a != b) 即 a == b: 操作数以作用于布尔值的OP_NOT结尾时两次取反抵消
+    if (operateType == TOKEN_BANG &&
+        boolNotOffset == currentChunk()->count - 1 && boolNotOffset >= start) {
+        currentChunk()->count--;
+        boolNotOffset = -1;
+        exprType = EXPR_ANY;
+        return;
+    }
+
     switch (operateType) {
-        case TOKEN_BANG:  emitByte(OP_NOT); break;
-        case TOKEN_MINUS: emitByte(OP_NEGATE);break;
+        case TOKEN_BANG:
+            emitByte(OP_NOT);
+            exprType = EXPR_ANY;
+            break;
+        case TOKEN_MINUS:
+            emitByte(numeric ? OP_NEGATE_NUMBER : OP_NEGATE);
+            exprType = EXPR_NUMBER;
+            break;
         default: return;
     }
 }
@@ -682,11 +1424,16 @@ static void parsePrecedence(Precedence precedence) {
     }
     // 根据优先级决定是否可以赋值
     bool canAssign = precedence <= PREC_ASSIGNMENT;
+    int start = currentChunk()->count;
+    int constants = currentChunk()->constants.count;
+    exprType = EXPR_ANY;
     prefixRule(canAssign);
 
     while (precedence <= getRule(parser.current.type)->precedence) {
         advance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
+        operandStart = start; // 左操作数从start开始
+        operandConstants = constants;
         infixRule(canAssign);
     }
     if (canAssign && match(TOKEN_EQUAL)) {
@@ -713,12 +1460,8 @@ static void block() {
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-// 函数编译
-static void function(FunctionType type) {
-    Compiler compiler;
-    initCompiler(&compiler, type);
-    beginScope();
-
+// 函数参数列表与函数体开头的'{'
+static void parameters() {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
     // 函数参数处理
     if (!check(TOKEN_RIGHT_PAREN)) {
@@ -727,45 +1470,140 @@ static void function(FunctionType type) {
             if (current->function->arity > 255) {
                 error("Cannot have more than 255 parameters.");
             }
-            uint8_t constant = parseVariable(
+            int constant = parseVariable(
                 "Can't have more than 255 parameter name.");
             defineVariable(constant);
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block();
+}
 
-    ObjFunction* function = endCompiler();
-    emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
-    for (int i = 0; i < function->upvalueCount; i++) {
-        emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upvalues[i].index);
+// 延迟编译: 能解析为外层变量的名字一律当作会被赋值的按引用捕获
+static void captureLazy(Token name) {
+    if (resolveLocal(current, &name) != -1) return;
+    int upvalue = resolveUpvalue(current, &name);
+    if (upvalue == -1) return;
+    assignUpvalue(current, upvalue);
+    current->upvalues[upvalue].name = name;
+}
+
+/*
+ * 延迟编译: 只按花括号配对跳过函数体, 函数体中的名字(属性名除外)
+ * 按外层作用域在此处的状态解析, 可能引用外层变量的都记为上值
+ */
+static void skipBody() {
+    int depth = 1;
+    while (!check(TOKEN_EOF)) {
+        TokenType before = parser.previous.type;
+        advance();
+        switch (parser.previous.type) {
+            case TOKEN_LEFT_BRACE:
+                depth++;
+                break;
+            case TOKEN_RIGHT_BRACE:
+                if (--depth == 0) return;
+                break;
+            case TOKEN_IDENTIFIER:
+                if (before != TOKEN_DOT) captureLazy(parser.previous);
+                break;
+            case TOKEN_THIS:
+                captureLazy(syntheticToken("this"));
+                break;
+            case TOKEN_SUPER:
+                captureLazy(syntheticToken("this"));
+                captureLazy(syntheticToken("super"));
+                break;
+            default:
+                break;
+        }
     }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+// 结束延迟编译函数的声明: 记下源码位置与上值名, 代码留到第一次调用时生成
+static ObjFunction* endLazy(const char* source, int line) {
+    ObjFunction* function = current->function;
+    function->lazySource = source;
+    function->lazyLine = line;
+    function->lazyType = (uint8_t)current->type;
+    if (function->upvalueCount > 0) {
+        ObjString** names = ALLOCATE(ObjString*, function->upvalueCount);
+        for (int i = 0; i < function->upvalueCount; i++) names[i] = NULL;
+        function->upvalueNames = names;
+        for (int i = 0; i < function->upvalueCount; i++) {
+            Token* name = &current->upvalues[i].name;
+            names[i] = copyString(name->start, name->length);
+        }
+    }
+    arenaRelease(&compilerArena, current->mark);
+    current = current->enclosing;
+    boolNotOffset = -1;
+    return function;
+}
+
+// 函数编译
+static ObjFunction* function(FunctionType type) {
+    // 只延迟顶层声明的函数与方法 嵌套的函数随外层函数体一起编译
+    bool lazy = compileOptions.lazy && !compileOptions.repl &&
+                current->type == TYPE_SCRIPT;
+    const char* source = parser.current.start;
+    int line = parser.current.line;
+
+    Compiler compiler;
+    initCompiler(&compiler, type, NULL);
+    beginScope();
+    parameters();
+
+    if (lazy) {
+        skipBody();
+    } else {
+        block();
+    }
+    // 结束编译时上值数组随区域归还 先记下捕获方式
+    uint8_t captures[UINT8_COUNT * 2];
+    for (int i = 0; i < current->function->upvalueCount; i++) {
+        Upvalue* upvalue = &compiler.upvalues[i];
+        if (upvalue->byValue) {
+            captures[i * 2] = upvalue->isLocal
+                ? CAPTURE_LOCAL_VALUE : CAPTURE_UPVALUE_VALUE;
+        } else {
+            captures[i * 2] = upvalue->isLocal
+                ? CAPTURE_LOCAL : CAPTURE_UPVALUE;
+        }
+        captures[i * 2 + 1] = upvalue->index;
+    }
+    ObjFunction* function = lazy ? endLazy(source, line) : endCompiler();
+
+    emitConstantOp(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+    for (int i = 0; i < function->upvalueCount * 2; i++) {
+        emitByte(captures[i]);
+    }
+    return function;
 }
 
 // 类方法解析
 static void method() {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+    int constant = identifierConstant(&parser.previous);
     FunctionType type = TYPE_METHOD;
     if (parser.previous.length == 4 && 
         memcmp(parser.previous.start, "init", 4) == 0) {
       type = TYPE_INITIALIZER;
     }
     function(type);
-    emitBytes(OP_METHOD, constant);
+    emitConstantOp(OP_METHOD, constant);
 }
 
 // class标识：声明类
 static void classDeclaration() {
     consume(TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(&parser.previous);// 将类名将类对象与常量绑定
+    int nameConstant = identifierConstant(&parser.previous);// 将类名将类对象与常量绑定
 
     // 类声明
     declareVariable();
-    emitBytes(OP_CLASS, nameConstant);
+    emitConstantOp(OP_CLASS, nameConstant);
     defineVariable(nameConstant);
 
     ClassCompiler classCompiler;
@@ -810,18 +1648,28 @@ static void classDeclaration() {
 
 // fun标识：声明函数
 static void funDeclaration() {
-    uint8_t global = parseVariable("Expect function name.");
+    int global = parseVariable("Expect function name.");
     markInitialized(); // 在编译函数主体之前就将函数声明的变量标记为已初始化
-    function(TYPE_FUNCTION);
+    ObjFunction* compiled = function(TYPE_FUNCTION);
+    if (current->scopeDepth == 0 && !parser.hadError) {
+        registerInline(AS_STRING(currentChunk()->constants.values[global]),
+                       compiled);
+    }
     defineVariable(global);
 }
 
 // var标识: 声明变量
 static void varDeclaration() {
-    uint8_t global = parseVariable("Expect variable name.");
+    int global = parseVariable("Expect variable name.");
 
     if (match(TOKEN_EQUAL)) {
         expression();
+        // 初始值是数字的局部变量在出现非数字赋值之前都视为数字
+        if (current->scopeDepth > 0 && IS_NUMERIC(exprType)) {
+            Local* local = &current->locals[current->localCount - 1];
+            local->isNumber = true;
+            local->fromLocal = exprType == EXPR_LOCAL_NUMBER;
+        }
     } else {
         emitByte(OP_NIL);
     }
@@ -1066,19 +1914,62 @@ static void statement() {
 
 ObjFunction* compile(const char* source) {
     initScanner(source);
+    vm.compiling = true;
     Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
     parser.hadError = false;
     parser.panicMode = false;
+    inlineCandidateCount = 0;
     advance();
     while (!match(TOKEN_EOF)) {
         declaration();
     }
 
     ObjFunction* function = endCompiler();
+    vm.compiling = false;
     return parser.hadError ? NULL : function;
 }
 
+bool compileLazy(ObjFunction* function) {
+    FunctionType type = (FunctionType)function->lazyType;
+    initScannerAt(function->lazySource, function->lazyLine);
+    function->lazySource = NULL;
+    function->arity = 0; // 参数重新解析一遍
+    parser.hadError = false;
+    parser.panicMode = false;
+    vm.compiling = true;
+
+    Compiler compiler;
+    initCompiler(&compiler, type, function);
+    for (int i = 0; i < function->upvalueCount; i++) {
+        ObjString* name = function->upvalueNames[i];
+        Upvalue* upvalue = &compiler.upvalues[i];
+        upvalue->index = (uint8_t)i;
+        upvalue->isLocal = false;
+        upvalue->byValue = false;
+        upvalue->name.type = TOKEN_IDENTIFIER;
+        upvalue->name.start = name->chars;
+        upvalue->name.length = name->length;
+        upvalue->name.line = function->lazyLine;
+    }
+    // 外层类只用于检查this与super: 方法捕获了super说明类有父类
+    Token superName = syntheticToken("super");
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = NULL;
+    classCompiler.hasSuperclass =
+        resolveUpvalue(&compiler, &superName) != -1;
+    currentClass = type == TYPE_FUNCTION ? NULL : &classCompiler;
+
+    advance();
+    beginScope();
+    parameters();
+    block();
+    endCompiler();
+    currentClass = NULL;
+    vm.compiling = false;
+    return !parser.hadError;
+}
+
 void markCompilerRoots() {
     Compiler* compiler = current;
     while (compiler != NULL) {
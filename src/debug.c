@@ -38,6 +38,15 @@ static int jumpInstruction(const char* name, int sign,
     return offset + 3;
 }
 
+// 长格式跳转指令反汇编
+static int longJumpInstruction(const char* name, int sign,
+                               Chunk* chunk, int offset) {
+    int jump = readLong(&chunk->code[offset + 1]);
+    printf("%-16s %4d -> %d\n", name, offset,
+           offset + 4 + sign * jump);
+    return offset + 4;
+}
+
 // 多操作数反汇编
 static int constantInstruction(const char* name, Chunk* chunk,
                                int offset)
@@ -49,6 +58,36 @@ static int constantInstruction(const char* name, Chunk* chunk,
     return offset + 2;
 }
 
+// 长格式常量指令反汇编
+static int constantLongInstruction(const char* name, Chunk* chunk,
+                                   int offset)
+{
+    int constant = readLong(&chunk->code[offset + 1]);
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+// 两个槽号的融合指令反汇编
+static int slotsInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t a = chunk->code[offset + 1];
+    uint8_t b = chunk->code[offset + 2];
+    printf("%-16s %4d %4d\n", name, a, b);
+    return offset + 3;
+}
+
+// 槽号与常量的融合指令反汇编
+static int slotConstantInstruction(const char* name, Chunk* chunk,
+                                   int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
 // 方法调用反汇编
 static int invokeInstruction(const char* name, Chunk* chunk,
                              int offset) {
@@ -63,18 +102,21 @@ static int invokeInstruction(const char* name, Chunk* chunk,
 int disassembleInstruction(Chunk* chunk, int offset)
 {
     printf("%04d ", offset);
-    if (offset > 0 &&
-        chunk->lines[offset] == chunk->lines[offset - 1])
+    int line = getLine(chunk, offset);
+    if (offset > 0 && line == getLine(chunk, offset - 1))
     {
         printf("    | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
     uint8_t instruction = chunk->code[offset];
 
     switch (instruction) {
     case OP_CONSTANT:
         return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_SMALL_INT:
+        printf("%-16s %4d\n", "OP_SMALL_INT", (int8_t)chunk->code[offset + 1]);
+        return offset + 2;
     case OP_NIL: 
         return simpleInstruction("OP_NIL", offset);
     case OP_TRUE:
@@ -100,6 +142,8 @@ int disassembleInstruction(Chunk* chunk, int offset)
         return byteInstruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
         return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+    case OP_GET_CAPTURED:
+        return byteInstruction("OP_GET_CAPTURED", chunk, offset);
     case OP_GET_PROPERTY:
         return constantInstruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:
@@ -112,6 +156,12 @@ int disassembleInstruction(Chunk* chunk, int offset)
         return simpleInstruction("OP_GREATER", offset);
     case OP_LESS:
         return simpleInstruction("OP_LESS", offset);
+    case OP_NOT_EQUAL:
+        return simpleInstruction("OP_NOT_EQUAL", offset);
+    case OP_NOT_GREATER:
+        return simpleInstruction("OP_NOT_GREATER", offset);
+    case OP_NOT_LESS:
+        return simpleInstruction("OP_NOT_LESS", offset);
     case OP_ADD:
         return simpleInstruction("OP_ADD", offset);
     case OP_SUBTRACT:
@@ -124,12 +174,28 @@ int disassembleInstruction(Chunk* chunk, int offset)
         return simpleInstruction("OP_NOT", offset);
     case OP_NEGATE:
         return simpleInstruction("OP_NEGATE", offset);
+    case OP_ADD_NUMBER:
+        return simpleInstruction("OP_ADD_NUMBER", offset);
+    case OP_SUBTRACT_NUMBER:
+        return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
+    case OP_MULTIPLY_NUMBER:
+        return simpleInstruction("OP_MULTIPLY_NUMBER", offset);
+    case OP_DIVIDE_NUMBER:
+        return simpleInstruction("OP_DIVIDE_NUMBER", offset);
+    case OP_NEGATE_NUMBER:
+        return simpleInstruction("OP_NEGATE_NUMBER", offset);
+    case OP_GREATER_NUMBER:
+        return simpleInstruction("OP_GREATER_NUMBER", offset);
+    case OP_LESS_NUMBER:
+        return simpleInstruction("OP_LESS_NUMBER", offset);
     case OP_PRINT:
         return simpleInstruction("OP_PRINT", offset);
     case OP_JUMP:
         return jumpInstruction("OP_JUMP", 1, chunk, offset);
     case OP_JUMP_IF_FALSE:
         return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE:
+        return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
     case OP_LOOP:
         return jumpInstruction("OP_LOOP", -1, chunk, offset);
     case OP_CALL:
@@ -138,26 +204,97 @@ int disassembleInstruction(Chunk* chunk, int offset)
         return invokeInstruction("OP_INVOKE", chunk, offset);
     case OP_SUPER_INVOKE:
         return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
-    case OP_CLOSURE: {
-        offset++;
-        uint8_t constant = chunk->code[offset++];
-        printf("%-16s %4d", "OP_CLOSURE", constant);
+    case OP_CLOSURE:
+    case OP_CLOSURE_LONG: {
+        int constant = constantOperand(chunk, offset);
+        offset += instruction == OP_CLOSURE ? 2 : 4;
+        printf("%-16s %4d", instruction == OP_CLOSURE
+               ? "OP_CLOSURE" : "OP_CLOSURE_LONG", constant);
         printValue(chunk->constants.values[constant]);
         printf("\n");
 
         ObjFunction* function = AS_FUNCTION(
             chunk->constants.values[constant]);
         for (int j = 0; j < function->upvalueCount; j++) {
-            int isLocal = chunk->code[offset++];
+            static const char* kinds[] = {
+                "upvalue", "local", "local value", "upvalue value"
+            };
+            int kind = chunk->code[offset++];
             int index = chunk->code[offset++];
             printf("%04d     |                     %s %d\n",
-                  offset - 2, isLocal ? "local" : "upvalue", index);
+                  offset - 2, kinds[kind], index);
         }
 
         return offset;
     }
     case OP_CLOSE_UPVALUE:
         return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+    case OP_PICK:
+        return byteInstruction("OP_PICK", chunk, offset);
+    case OP_SLIDE:
+        return byteInstruction("OP_SLIDE", chunk, offset);
+    case OP_GET_LOCAL_PAIR:
+        return slotsInstruction("OP_GET_LOCAL_PAIR", chunk, offset);
+    case OP_GET_LOCAL_CONSTANT:
+        return slotConstantInstruction("OP_GET_LOCAL_CONSTANT", chunk, offset);
+    case OP_STORE_LOCAL:
+        return byteInstruction("OP_STORE_LOCAL", chunk, offset);
+    case OP_INCREMENT_LOCAL:
+        printf("%-16s %4d %4d\n", "OP_INCREMENT_LOCAL",
+               chunk->code[offset + 1], (int8_t)chunk->code[offset + 2]);
+        return offset + 3;
+    case OP_GET_LOCAL_0:
+        return simpleInstruction("OP_GET_LOCAL_0", offset);
+    case OP_GET_LOCAL_1:
+        return simpleInstruction("OP_GET_LOCAL_1", offset);
+    case OP_GET_LOCAL_2:
+        return simpleInstruction("OP_GET_LOCAL_2", offset);
+    case OP_GET_LOCAL_3:
+        return simpleInstruction("OP_GET_LOCAL_3", offset);
+    case OP_GET_UPVALUE_0:
+        return simpleInstruction("OP_GET_UPVALUE_0", offset);
+    case OP_CALL_0:
+        return simpleInstruction("OP_CALL_0", offset);
+    case OP_CALL_1:
+        return simpleInstruction("OP_CALL_1", offset);
+    case OP_CALL_2:
+        return simpleInstruction("OP_CALL_2", offset);
+    case OP_INLINE_GUARD: {
+        uint8_t constant = chunk->code[offset + 1];
+        uint8_t argCount = chunk->code[offset + 2];
+        uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+        jump |= chunk->code[offset + 4];
+        printf("%-16s (%d args) %4d '", "OP_INLINE_GUARD", argCount, constant);
+        printValue(chunk->constants.values[constant]);
+        printf("' -> %d\n", offset + 5 + jump);
+        return offset + 5;
+    }
+    case OP_CONSTANT_LONG:
+        return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
+    case OP_GET_GLOBAL_LONG:
+        return constantLongInstruction("OP_GET_GLOBAL_LONG", chunk, offset);
+    case OP_DEFINE_GLOBAL_LONG:
+        return constantLongInstruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
+    case OP_SET_GLOBAL_LONG:
+        return constantLongInstruction("OP_SET_GLOBAL_LONG", chunk, offset);
+    case OP_GET_PROPERTY_LONG:
+        return constantLongInstruction("OP_GET_PROPERTY_LONG", chunk, offset);
+    case OP_SET_PROPERTY_LONG:
+        return constantLongInstruction("OP_SET_PROPERTY_LONG", chunk, offset);
+    case OP_GET_SUPER_LONG:
+        return constantLongInstruction("OP_GET_SUPER_LONG", chunk, offset);
+    case OP_CLASS_LONG:
+        return constantLongInstruction("OP_CLASS_LONG", chunk, offset);
+    case OP_METHOD_LONG:
+        return constantLongInstruction("OP_METHOD_LONG", chunk, offset);
+    case OP_JUMP_LONG:
+        return longJumpInstruction("OP_JUMP_LONG", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE_LONG:
+        return longJumpInstruction("OP_JUMP_IF_FALSE_LONG", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE_LONG:
+        return longJumpInstruction("OP_JUMP_IF_TRUE_LONG", 1, chunk, offset);
+    case OP_LOOP_LONG:
+        return longJumpInstruction("OP_LOOP_LONG", -1, chunk, offset);
     case OP_CLASS:
         return constantInstruction("OP_CLASS", chunk, offset);
     case OP_INHERIT:
@@ -0,0 +1,102 @@
+#include <string.h>
+
+#include "include/hash.h"
+
+// wyhash 的默认密钥
+static const uint64_t secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+// 64位乘法 将128位乘积的高低两半分别写回a和b
+static inline void multiply(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+// 乘法混合
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    multiply(&a, &b);
+    return a ^ b;
+}
+
+// 非对齐读取 由编译器合并为单条装载指令
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 1~3字节: 取首、中、尾三个字节
+static inline uint64_t read3(const uint8_t* p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t hashBytes(const void* key, size_t length, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)key;
+    uint64_t a, b;
+    seed ^= mix(seed ^ secret[0], secret[1]);
+
+    if (length <= 16) {
+        if (length >= 4) {
+            // 首尾各取两个可能重叠的4字节
+            size_t offset = (length >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + offset);
+            b = (read32(p + length - 4) << 32) |
+                read32(p + length - 4 - offset);
+        } else if (length > 0) {
+            a = read3(p, length);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+        // 长字符串: 三路并行, 每轮48字节
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+                see1 = mix(read64(p + 16) ^ secret[2],
+                           read64(p + 24) ^ see1);
+                see2 = mix(read64(p + 32) ^ secret[3],
+                           read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        // 末尾16字节(可能与已处理部分重叠)
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    multiply(&a, &b);
+    return mix(a ^ secret[0] ^ length, b ^ secret[1]);
+}
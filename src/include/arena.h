@@ -0,0 +1,40 @@
+// 编译器内部使用的区域分配器
+
+#ifndef CLOX_ARENA_H
+#define CLOX_ARENA_H
+
+#include "common.h"
+
+/*
+ * 按块向前分配, 不单独释放; 嵌套函数的编译器先开始后结束,
+ * 用arenaMark记下位置, arenaRelease一次归还其后分配的全部空间。
+ * 分配不经过reallocate, 不计入GC的堆大小, 也不会触发回收
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* previous;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* block; // 当前块
+    ArenaBlock* spare; // 归还后留作下次使用的块
+} Arena;
+
+// 分配位置
+typedef struct {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+void initArena(Arena* arena);
+void freeArena(Arena* arena);
+
+// 分配size字节(按8字节对齐) 内容未初始化
+void* arenaAlloc(Arena* arena, size_t size);
+
+ArenaMark arenaMark(Arena* arena);
+void arenaRelease(Arena* arena, ArenaMark mark);
+
+#endif
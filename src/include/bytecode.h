@@ -0,0 +1,38 @@
+// 字节码文件(.loxc)
+
+#ifndef CLOX_BYTECODE_H
+#define CLOX_BYTECODE_H
+
+#include "object.h"
+
+/*
+ * 文件内容依次为: 魔数"LOXC"、格式版本、键、其后全部内容的校验和,
+ * 然后是顶层函数。
+ * 每个函数写出参数与上值数量、函数名、代码、行号表(行程编码, 每段为
+ * 起始偏移与行号)与常量表,
+ * 常量中的字符串按内容写出(载入时重新驻留), 内层函数递归写出,
+ * 同一函数对象再次出现时(如内联守卫)按写出顺序的下标引用。
+ * 整数与浮点数一律按小端序写出。
+ *
+ * 载入时把文件只读映射进内存, 代码、行号表(对齐到4字节)与字符串常量
+ * (以'\0'结尾)都直接引用映射而不复制, 映射保留到进程结束;
+ * 行号表按原样当作LineStart数组, 只支持小端序主机
+ *
+ * 校验和不符、代码为空或未通过逐条检查(操作码、指令长度、常量与上值下标、
+ * 跳转目标)的文件视为损坏, 调用者改为重新编译
+ *
+ * 修改指令集或文件格式时递增版本, 旧文件与旧缓存随之失效
+ */
+#define BYTECODE_VERSION 4
+
+// 源代码连同编译选项、格式版本与解释器构建标识的哈希 作为编译缓存的键
+uint64_t bytecodeKey(const char* source);
+
+// 把顶层函数写入path(先写临时文件再改名) 失败返回false
+bool writeBytecode(ObjFunction* function, uint64_t key, const char* path);
+
+// 读取path中的顶层函数; 文件不存在、损坏、版本不符或key非0且与文件中的键
+// 不同时返回NULL
+ObjFunction* readBytecode(const char* path, uint64_t key);
+
+#endif
@@ -6,9 +6,13 @@
 #include "common.h"
 #include "value.h"
 
+// 长格式三字节操作数的上限
+#define UINT24_MAX 0xffffff
+
 // 操作码
 typedef enum {
     OP_CONSTANT,
+    OP_SMALL_INT, // 操作数即-128~127的整数 不占常量表
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
@@ -20,27 +24,68 @@ typedef enum {
     OP_SET_GLOBAL,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
+    OP_GET_CAPTURED, // 读取按值捕获的上值
     OP_GET_PROPERTY,
     OP_SET_PROPERTY,
     OP_GET_SUPER,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+    OP_NOT_EQUAL,   // !(a == b) 由窥孔优化合并
+    OP_NOT_GREATER, // !(a > b)
+    OP_NOT_LESS,    // !(a < b)
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_ADD_NUMBER, // 操作数已在编译期证明是数字 不做类型检查
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_NEGATE_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_LESS_NUMBER,
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE, // 由窥孔优化生成
     OP_LOOP,
     OP_CALL,
     OP_INVOKE, // 方法快速调用
     OP_SUPER_INVOKE,
     OP_CLOSURE,
     OP_CLOSE_UPVALUE,
+    OP_PICK,         // 复制距栈顶指定深度的值 用于内联函数读取参数
+    OP_SLIDE,        // 保留栈顶 丢弃其下指定数量的值
+    OP_INLINE_GUARD, // 被调用者不是内联时的函数则跳转到普通调用
+    OP_GET_LOCAL_PAIR,     // 按槽位寻址的融合指令(-R): 压入两个局部变量
+    OP_GET_LOCAL_CONSTANT, // 压入局部变量与常量
+    OP_STORE_LOCAL,        // 弹出栈顶存入局部变量
+    OP_INCREMENT_LOCAL,    // 数字局部变量原地加上小整数
+    OP_GET_LOCAL_0, // 短格式: 操作数内嵌在操作码中, 由窥孔优化最后生成
+    OP_GET_LOCAL_1,
+    OP_GET_LOCAL_2,
+    OP_GET_LOCAL_3,
+    OP_GET_UPVALUE_0,
+    OP_CALL_0,
+    OP_CALL_1,
+    OP_CALL_2,
+    OP_CONSTANT_LONG, // 长格式: 常量下标或跳转偏移量占三字节, 超出一般格式的范围时才生成
+    OP_GET_GLOBAL_LONG,
+    OP_DEFINE_GLOBAL_LONG,
+    OP_SET_GLOBAL_LONG,
+    OP_GET_PROPERTY_LONG,
+    OP_SET_PROPERTY_LONG,
+    OP_GET_SUPER_LONG,
+    OP_CLOSURE_LONG,
+    OP_CLASS_LONG,
+    OP_METHOD_LONG,
+    OP_JUMP_LONG,
+    OP_JUMP_IF_FALSE_LONG,
+    OP_JUMP_IF_TRUE_LONG,
+    OP_LOOP_LONG,
     OP_CLASS,
     OP_INHERIT, // 继承
     OP_METHOD,
@@ -48,13 +93,37 @@ typedef enum {
 
 }OpCode;
 
+// OP_CLOSURE中每个上值的捕获方式
+typedef enum {
+    CAPTURE_UPVALUE,       // 外层函数的上值
+    CAPTURE_LOCAL,         // 外层函数的局部变量
+    CAPTURE_LOCAL_VALUE,   // 复制从未被赋值的局部变量
+    CAPTURE_UPVALUE_VALUE, // 复制外层函数按值捕获的上值
+} CaptureKind;
+
+// 行号表按行程编码: 从字节偏移offset起直到下一段之前的字节都来自line行
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
 // 指令与常量动态存储
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
     ValueArray constants;
-    int* lines;
+    LineStart* lines; // 按offset递增
+    int lineCount;
+    int lineCapacity;
+    bool shared; // code与lines引用映射的字节码镜像(只读) 不归chunk所有
+    bool packed; // 常量表、lines与code收缩后同在一次分配中(见packChunk)
+    // 执行用的预解码形式: 每条指令一个32位字, 操作码占低8位,
+    // 字节操作数依次占后续各8位, 跳转目标(解码后的绝对下标)与
+    // 单独的常量下标占高24位, 长格式因此解码成一般格式
+    int wordCount;
+    uint32_t* words;
+    int* wordOffsets; // 每个字所属指令在code中的偏移 用于行号与反汇编
 
 }Chunk;
 
@@ -70,4 +139,37 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line);
 // 添加常量
 int addConstant(Chunk* chunk, Value value);
 
+// 位于offset的字节所在的源代码行(二分查找行号表)
+int getLine(Chunk* chunk, int offset);
+
+// 行号表追加一段 与上一段同一行时不追加
+void addLine(Chunk* chunk, int offset, int line);
+
+/*
+ * 编译结束后收缩: 常量表、行号表与代码按实际大小依次放进同一块内存,
+ * 之后只能就地修改代码, 不能再写入指令或添加常量
+ */
+void packChunk(Chunk* chunk);
+
+// 位于offset的指令的字节数(含操作数)
+int instructionLength(Chunk* chunk, int offset);
+
+// 短格式指令换成一般形式并写出内嵌的操作数, 其他指令原样返回
+uint8_t expandShortForm(uint8_t op, uint8_t* operand);
+
+// 指令的长格式, 没有长格式的指令原样返回
+uint8_t longForm(uint8_t op);
+
+// 长格式指令对应的一般格式, 其他指令原样返回
+uint8_t normalForm(uint8_t op);
+
+// 读取三字节(大端)的长格式操作数
+int readLong(uint8_t* code);
+
+// 位于offset的指令(一般或长格式)引用的常量下标
+int constantOperand(Chunk* chunk, int offset);
+
+// 把字节码解码成定长的指令字, 已解码过则重新生成
+void decodeChunk(Chunk* chunk);
+
 #endif
\ No newline at end of file
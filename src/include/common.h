@@ -13,6 +13,9 @@
 // 字节码运行时的堆栈状态
 // #define DEBUG_TRACE_EXECUTION
 
+// 统计执行的指令条数 退出时输出
+// #define DEBUG_COUNT_INSTRUCTIONS
+
 // 内存回收压力测试
 // #define DEBUG_STRESS_GC
 
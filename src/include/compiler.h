@@ -4,9 +4,25 @@
 #include "object.h"
 #include "vm.h"
 
+// 编译选项
+typedef struct {
+    int optimizeLevel; // 0: 只做窥孔优化 1: -O
+    bool repl;         // 交互模式
+    bool registers;    // -R: 生成按槽位寻址的融合指令
+    bool lazy;         // -L: 顶层函数与方法的函数体延迟到第一次调用时编译
+} CompileOptions;
+
+extern CompileOptions compileOptions;
+
 // 编译源代码字符串
 ObjFunction* compile(const char* source);
 
+/*
+ * 编译延迟编译的函数体, 源代码须仍然有效; 出错时报告编译错误并返回false
+ * 编译完成后的函数与立即编译的相同(外层变量一律按引用捕获)
+ */
+bool compileLazy(ObjFunction* function);
+
 // 标记编译期访问的值
 void markCompilerRoots();
 
@@ -0,0 +1,23 @@
+// 字符串哈希
+
+#ifndef CLOX_HASH_H
+#define CLOX_HASH_H
+
+#include <stddef.h>
+#include "common.h"
+
+/*
+ * 哈希洪泛(hash flooding)立场:
+ * 哈希表的键只来自程序源码中的标识符、字符串字面量及其运算结果,
+ * 解释器不把外部输入直接作为键, 因此不把抗碰撞攻击作为安全边界。
+ * 种子固定(可用 -DHASH_SEED=... 覆盖), 保证同一字符串在不同进程中哈希一致;
+ * 若要运行不可信的脚本, 应在编译时换成随机种子。
+ */
+#ifndef HASH_SEED
+#define HASH_SEED 0x9e3779b97f4a7c15ull
+#endif
+
+// 按字(8字节)读取的wyhash风格哈希
+uint64_t hashBytes(const void* key, size_t length, uint64_t seed);
+
+#endif
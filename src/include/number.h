@@ -0,0 +1,24 @@
+// 数字与字符串的相互转换
+
+#ifndef CLOX_NUMBER_H
+#define CLOX_NUMBER_H
+
+#include "common.h"
+
+// formatNumber 所需的缓冲区大小(含'\0')
+#define NUMBER_BUFFER_SIZE 32
+
+/*
+ * 将数字格式化为能精确还原的最短十进制表示(Grisu2), 返回长度(不含'\0')
+ * 格式与JavaScript一致: 1e-7 <= |x| < 1e21 使用定点表示, 其余使用指数表示
+ * 如 3, 0.1, 123.456, 1e+21, 1.5e-7; 特殊值为 nan、inf、-inf、-0
+ */
+int formatNumber(double value, char* buffer);
+
+/*
+ * 解析数字字面量(形如 123 或 1.25, 不含符号与指数), 结果按IEEE就近舍入
+ * 只读取[chars, chars + length), 与区域设置(locale)无关
+ */
+double parseNumber(const char* chars, int length);
+
+#endif
@@ -56,6 +56,11 @@ typedef struct {
     int upvalueCount;// 上值数量
     Chunk chunk;
     ObjString* name;
+    // 延迟编译(-L): 只记下参数列表在源码中的位置, 第一次调用时才编译函数体
+    const char* lazySource; // 为NULL表示已编译
+    int lazyLine;
+    uint8_t lazyType; // 编译器的函数类型
+    ObjString** upvalueNames; // 上值对应的变量名 编译函数体时按名字查找
 } ObjFunction;
 
 // 标准库函数引用(不解释为字节码，直接指向C代码)
@@ -68,13 +73,24 @@ typedef struct {
 } ObjNative;
 
 // 字符串结构体
+// 连接产生的长字符串先以绳索(rope)保存: chars为NULL, left/right为左右子串,
+// 直到比较、打印或驻留时才展开并计算哈希; 展开后left指向驻留字符串, chars与之共享
 struct ObjString {
     Obj obj;
     int length;
     char* chars;
     uint32_t hash;
+    bool borrowed; // chars引用映射的字节码镜像 不归字符串所有
+    ObjString* left;
+    ObjString* right;
 };
 
+// 长度达到该值的连接结果以绳索形式延迟展开
+#define ROPE_MIN_LENGTH 32
+
+// 尚未展开的绳索
+#define IS_ROPE(string) ((string)->chars == NULL)
+
 // 闭包上值结构体
 typedef struct ObjUpvalue {
     Obj obj;
@@ -88,9 +104,14 @@ typedef struct {
     Obj obj;
     ObjFunction* function;
     ObjUpvalue** upvalues;// 上值数组
+    Value* values;// 按值捕获的上值 与上值数组共用一块内存
     int upvalueCount;// 上值数量
 } ObjClosure;
 
+// 闭包上值数组与按值捕获数组的总字节数
+#define CLOSURE_CAPTURES_SIZE(count) \
+    ((size_t)(count) * (sizeof(Value) + sizeof(ObjUpvalue*)))
+
 // 类结构体
 typedef struct {
     Obj obj;
@@ -100,7 +121,7 @@ typedef struct {
 
 // 类实例
 typedef struct {
-    Obj* obj;
+    Obj obj;
     ObjClass* class;
     Table fields;
 } ObjInstance;
@@ -137,6 +158,18 @@ ObjString* takeString(char* chars, int length);
 // 去除开头及结尾的引号并复制字符串(无所有权)
 ObjString* copyString(const char* chars, int length);
 
+// 引用外部以'\0'结尾的只读字符(不复制也不释放), 调用方保证其一直有效
+ObjString* borrowString(const char* chars, int length);
+
+// 创建绳索 延迟连接两个字符串(调用方需保证a、b可被GC追踪)
+ObjString* newRope(ObjString* a, ObjString* b);
+
+// 展开并驻留字符串 返回驻留表中的唯一实例
+ObjString* internString(ObjString* string);
+
+// 字符串相等(绳索需展开后按驻留实例比较)
+bool stringsEqual(ObjString* a, ObjString* b);
+
 // 上值构造函数
 ObjUpvalue* newUpvalue(Value* slot);
 
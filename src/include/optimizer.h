@@ -0,0 +1,25 @@
+// 字节码优化
+
+#ifndef CLOX_OPTIMIZER_H
+#define CLOX_OPTIMIZER_H
+
+#include "chunk.h"
+
+/*
+ * 把函数的字节码解码成指令序列并划分基本块, 反复优化直到不再变化后
+ * 重新编码, 就地替换chunk的代码与行号表(跳转偏移量与行号随之调整,
+ * 编译器写入的长格式跳转在偏移量放得下时改回一般格式)
+ *
+ * 每个函数都会做的窥孔优化(level 0):
+ *   合并比较与取反、NOT+JUMP_IF_FALSE改为JUMP_IF_TRUE、删除纯压栈后的POP、
+ *   跳转线程化、删除不可达代码(如显式return后的NIL RETURN)
+ * -O (level 1) 另外做: 常量条件跳转化简、存储-加载转发
+ *
+ * -R (registers) 最后把局部变量的读写融合成按槽位寻址的指令
+ * 编码前把常用的小操作数换成短格式指令(GET_LOCAL 0~3、CALL 0~2等)
+ *
+ * 交互模式下每条POP都会打印结果, repl为true时不做删除POP的变换
+ */
+void optimizeChunk(Chunk* chunk, int level, bool repl, bool registers);
+
+#endif
@@ -0,0 +1,37 @@
+// 标准输出缓冲
+
+#ifndef CLOX_OUTPUT_H
+#define CLOX_OUTPUT_H
+
+#include "common.h"
+
+// 缓冲区大小
+#define OUTPUT_BUFFER_SIZE 65536
+
+// 虚拟机持有的输出缓冲区
+// 在程序退出、向stderr报错前、调用flush()时写出; 交互终端下按行写出
+typedef struct {
+    char buffer[OUTPUT_BUFFER_SIZE];
+    int count;
+    bool lineBuffered;
+} OutputBuffer;
+
+// 初始化输出缓冲区
+void initOutput();
+
+// 写出缓冲区中的全部内容
+void flushOutput();
+
+// 追加字符
+void writeOutput(const char* chars, int length);
+
+// 追加以'\0'结尾的字符串
+void writeString(const char* string);
+
+// 追加数字
+void writeNumber(double number);
+
+// 在缓冲区中预留length字节供调用方直接写入 放不下时返回NULL
+char* reserveOutput(int length);
+
+#endif
@@ -34,6 +34,9 @@ typedef struct {
 // 初始化扫描器
 void initScanner(const char* source);
 
+// 从源码中间的某处开始扫描(延迟编译函数体)
+void initScannerAt(const char* position, int line);
+
 // 运算符标识
 Token scanToken();
 
@@ -10,11 +10,27 @@ typedef struct {
     Value value;
 } Entry;
 
+// 容量不超过该值的表使用线性模式
+#define TABLE_LINEAR_MAX 8
+
 // 哈希表
+// 小表(线性模式): 键紧凑存放在keys中, 按指针比较顺序查找, 无需哈希;
+// 超过TABLE_LINEAR_MAX后转为Swiss table布局: 条目数组之外另有控制字节数组,
+// 每个槽一个字节记录空、墓碑或哈希值的低7位, 查找时以16个控制字节为一组用SIMD比较
 typedef struct {
     int count;// 键值对数
+    int tombstones;// 墓碑数(仅哈希模式)
     int capacity;// 容量
-    Entry* entries;
+    union {
+        struct {
+            Entry* entries;// 分配块的起始地址(与keys相同)
+            int8_t* control;// 控制字节
+        };
+        struct {
+            ObjString** keys;
+            Value* values;
+        };
+    };
 } Table;
 
 // 初始化哈希表
@@ -5,6 +5,7 @@
 #include "value.h"
 #include "table.h"
 #include "object.h"
+#include "output.h"
 
 // 最大调用帧数
 #define FRAMES_MAX 64
@@ -13,7 +14,7 @@
 // 函数调用帧
 typedef struct {
     ObjClosure* closure;// 闭包函数本体
-    uint8_t* ip;// 调用者地址
+    uint32_t* ip;// 下一条将执行的指令字
     Value* slots;// 函数可供使用的槽
 } CallFrame;
 
@@ -31,10 +32,15 @@ typedef struct {
     ObjUpvalue* openUpvalues;
     size_t bytesAllocated;
     size_t nextGC;
+    bool compiling; // 编译期间分配的对象几乎都存活 不触发回收
     Obj* objects;
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
+    OutputBuffer output; // print语句的输出缓冲
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+    uint64_t instructionCount; // 已执行的指令条数
+#endif
 
 }VM;
 
@@ -56,6 +62,9 @@ void freeVM();
 // 解释运行并检查错误
 InterpretResult interpret(const char* source, int flag);
 
+// 运行已编译(或从字节码文件读入)的顶层函数
+InterpretResult interpretFunction(ObjFunction* function, int flag);
+
 // 压数据入栈
 void push(Value value);
 
@@ -1,15 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "include/common.h"
+#include "include/bytecode.h"
 #include "include/chunk.h"
+#include "include/compiler.h"
 #include "include/debug.h"
 #include "include/vm.h"
 
 static void repl() {
 	char line[1024];
 	int flag = 1;
+	compileOptions.repl = true;
 
 	printf("Clox 1.5.0 (main, Agu 1 2023, 06:56:58) ");
 	printf("[Command Line Mode]\n");
@@ -23,6 +27,7 @@ static void repl() {
 		}
 
 		interpret(line, flag);
+		flushOutput();
 
 	}
 
@@ -56,26 +61,143 @@ static char* readFile(const char* path) {
 	return buffer;
 }
 
+// --no-cache: 不读写编译缓存; 打印字节码的调试版本总是重新编译
+#ifdef DEBUG_PRINT_CODE
+static bool useCache = false;
+#else
+static bool useCache = true;
+#endif
+
+static bool hasSuffix(const char* string, const char* suffix) {
+	size_t length = strlen(string);
+	size_t suffixLength = strlen(suffix);
+	return length >= suffixLength &&
+		strcmp(string + length - suffixLength, suffix) == 0;
+}
+
+// 编译缓存目录: $CLOX_CACHE_DIR, 否则为$XDG_CACHE_HOME/clox或~/.cache/clox
+// 目录不存在时逐级创建, 失败返回false
+static bool cacheDirectory(char* path, size_t size) {
+	const char* dir = getenv("CLOX_CACHE_DIR");
+	if (dir != NULL && dir[0] != '\0') {
+		snprintf(path, size, "%s", dir);
+	} else if ((dir = getenv("XDG_CACHE_HOME")) != NULL && dir[0] != '\0') {
+		mkdir(dir, 0755);
+		snprintf(path, size, "%s/clox", dir);
+	} else if ((dir = getenv("HOME")) != NULL && dir[0] != '\0') {
+		snprintf(path, size, "%s/.cache", dir);
+		mkdir(path, 0755);
+		snprintf(path, size, "%s/.cache/clox", dir);
+	} else {
+		return false;
+	}
+	mkdir(path, 0755);
+	struct stat info;
+	return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// 编译源代码, 结果按源代码与编译选项的哈希缓存为.loxc文件, 命中缓存时跳过编译
+static ObjFunction* compileCached(const char* source) {
+	char path[4096];
+	uint64_t key = 0;
+	bool cacheable = false;
+	if (useCache && !compileOptions.lazy && cacheDirectory(path, sizeof(path) - 32)) {
+		key = bytecodeKey(source);
+		size_t length = strlen(path);
+		snprintf(path + length, sizeof(path) - length, "/%016llx.loxc",
+				 (unsigned long long)key);
+		ObjFunction* function = readBytecode(path, key);
+		if (function != NULL) return function;
+		cacheable = true;
+	}
+
+	ObjFunction* function = compile(source);
+	if (function != NULL && cacheable) {
+		writeBytecode(function, key, path); // 写入失败不影响运行
+	}
+	return function;
+}
+
 static void runFile(const char* path) {
 	int flag = -1;
-	char* source = readFile(path);
-	InterpretResult result = interpret(source, flag);
-	free(source);
+	ObjFunction* function;
+	char* source = NULL;
+	if (hasSuffix(path, ".loxc")) {
+		function = readBytecode(path, 0);
+		if (function == NULL) {
+			fprintf(stderr, "Could not load bytecode file \"%s\".\n", path);
+			exit(74);
+		}
+	} else {
+		source = readFile(path);
+		function = compileCached(source);
+		if (function == NULL) exit(65);
+	}
 
-	if (result == INTERPRET_COMPILE_ERROR) exit(65);
+	// 延迟编译的函数体在运行中才编译 源代码保留到运行结束
+	InterpretResult result = interpretFunction(function, flag);
+	free(source);
 	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+// --compile: 只编译并写出字节码文件, 默认输出为源文件名加c(.lox -> .loxc)
+static void compileFile(const char* path, const char* output) {
+	char defaultOutput[4096];
+	if (output == NULL) {
+		snprintf(defaultOutput, sizeof(defaultOutput),
+				 hasSuffix(path, ".lox") ? "%sc" : "%s.loxc", path);
+		output = defaultOutput;
+	}
+
+	compileOptions.lazy = false; // 字节码文件须包含全部函数体
+	char* source = readFile(path);
+	ObjFunction* function = compile(source);
+	uint64_t key = bytecodeKey(source);
+	free(source);
+	if (function == NULL) exit(65);
+	if (!writeBytecode(function, key, output)) {
+		fprintf(stderr, "Could not write \"%s\".\n", output);
+		exit(74);
+	}
+}
+
 int main(int argc, const char* argv[])
 {
 	initVM();
-	if (argc == 1) {
+	// -O: 开启可选的字节码优化
+	// -R: 融合按槽位寻址的指令, 与纯栈式指令对比指令数与耗时
+	// --compile: 编译成.loxc文件而不运行
+	// -L: 顶层函数与方法在第一次调用时才编译 (不使用编译缓存)
+	// --no-cache: 不使用编译缓存
+	bool compileOnly = false;
+	int arg = 1;
+	for (; argc > arg && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-O") == 0) {
+			compileOptions.optimizeLevel = 1;
+		} else if (strcmp(argv[arg], "-R") == 0) {
+			compileOptions.registers = true;
+		} else if (strcmp(argv[arg], "-L") == 0) {
+			compileOptions.lazy = true;
+		} else if (strcmp(argv[arg], "--compile") == 0) {
+			compileOnly = true;
+		} else if (strcmp(argv[arg], "--no-cache") == 0) {
+			useCache = false;
+		} else {
+			break;
+		}
+	}
+	if (compileOnly && (argc == arg + 1 || argc == arg + 2)) {
+		compileFile(argv[arg], argc == arg + 2 ? argv[arg + 1] : NULL);
+	} else if (compileOnly) {
+		fprintf(stderr, "Usage: clox [-O] [-R] --compile path [output]\n");
+		exit(64);
+	} else if (argc == arg) {
 		repl();
-	} else if (argc == 2)
+	} else if (argc == arg + 1)
 	{
-		runFile(argv[1]);
+		runFile(argv[arg]);
 	} else {
-		fprintf(stderr, "Usage: clox [path]\n");
+		fprintf(stderr, "Usage: clox [-O] [-R] [-L] [--no-cache] [path]\n");
 		exit(64);
 	}
 	freeVM();
@@ -17,11 +17,11 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 #ifdef DEBUG_STRESS_GC
     collectGarbage();
 #endif
-    }
-
-    // 根据分配空间的大小决定垃圾回收频率
-    if (vm.bytesAllocated > vm.nextGC) {
-        collectGarbage();
+        // 根据分配空间的大小决定垃圾回收频率(释放时不触发, 避免在sweep中重入)
+        // 编译期间推迟到编译结束后的下一次分配
+        if (vm.bytesAllocated > vm.nextGC && !vm.compiling) {
+            collectGarbage();
+        }
     }
 
     if (newSize == 0) {
@@ -97,6 +97,7 @@ static void blackenObject(Obj* object) {
             markObject((Obj*)closure->function);
             for (int i = 0; i < closure->upvalueCount; i++) {
                 markObject((Obj*)closure->upvalues[i]);
+                markValue(closure->values[i]);
             }
             break;
         }
@@ -104,6 +105,11 @@ static void blackenObject(Obj* object) {
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
             markArray(&function->chunk.constants);
+            if (function->upvalueNames != NULL) {
+                for (int i = 0; i < function->upvalueCount; i++) {
+                    markObject((Obj*)function->upvalueNames[i]);
+                }
+            }
             break;
         }
         case OBJ_INSTANCE: {
@@ -112,11 +118,17 @@ static void blackenObject(Obj* object) {
             markTable(&instance->fields);
             break;
         }
+        case OBJ_STRING: {
+            // 绳索的子串 或展开后共享字符的驻留字符串
+            ObjString* string = (ObjString*)object;
+            markObject((Obj*)string->left);
+            markObject((Obj*)string->right);
+            break;
+        }
         case OBJ_UPVALUE:
             markValue(((ObjUpvalue*)object)->closed);
             break;
         case OBJ_NATIVE:
-        case OBJ_STRING:
         break;
     }
 }
@@ -140,8 +152,8 @@ static void freeObject(Obj* object) {
         case OBJ_CLOSURE: {
             // 释放上值数组
             ObjClosure* closure = (ObjClosure*)object;
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues,
-                       closure->upvalueCount);
+            reallocate(closure->values,
+                       CLOSURE_CAPTURES_SIZE(closure->upvalueCount), 0);
             // 释放闭包
             FREE(ObjClosure, object);
             break;
@@ -149,6 +161,10 @@ static void freeObject(Obj* object) {
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
+            if (function->upvalueNames != NULL) {
+                FREE_ARRAY(ObjString*, function->upvalueNames,
+                           function->upvalueCount);
+            }
             FREE(ObjFunction, object);
             break;
         }
@@ -164,7 +180,10 @@ static void freeObject(Obj* object) {
         }
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
+            // 绳索不持有字符 展开后的字符归驻留字符串所有
+            if (string->left == NULL && !string->borrowed) {
+                FREE_ARRAY(char, string->chars, string->length + 1);
+            }
             FREE(ObjString, object);
             break;
         }
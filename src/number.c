@@ -0,0 +1,376 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/number.h"
+
+/*
+ * Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers", PLDI 2010)
+ * 用64位整数近似计算 得到的位数总能还原为原值, 绝大多数情况下也是最短的
+ */
+
+#define SIGNIFICAND_SIZE 52
+#define EXPONENT_BIAS (0x3FF + SIGNIFICAND_SIZE)
+#define MIN_EXPONENT (-EXPONENT_BIAS)
+#define HIDDEN_BIT 0x0010000000000000ULL
+#define SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define EXPONENT_MASK 0x7FF0000000000000ULL
+
+// 整数快速路径的上界 此范围内的整数都能被double精确表示
+#define EXACT_INTEGER_LIMIT 9007199254740992.0
+
+// 自定义浮点数 值为 f * 2^e
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+// 10^k 的规范化近似值, k = -348 + 8i (i = 0..86)
+static const uint64_t cachedPowersF[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cachedPowersE[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint32_t powersOf10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static DiyFp fromDouble(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased = (int)((bits & EXPONENT_MASK) >> SIGNIFICAND_SIZE);
+    uint64_t significand = bits & SIGNIFICAND_MASK;
+    DiyFp result;
+    if (biased != 0) {
+        result.f = significand + HIDDEN_BIT;
+        result.e = biased - EXPONENT_BIAS;
+    } else {
+        // 非规格化数
+        result.f = significand;
+        result.e = MIN_EXPONENT + 1;
+    }
+    return result;
+}
+
+// 两数相乘 取128位乘积的高64位(四舍五入)
+static DiyFp multiply(DiyFp x, DiyFp y) {
+    DiyFp result;
+#ifdef __SIZEOF_INT128__
+    __uint128_t p = (__uint128_t)x.f * y.f;
+    uint64_t high = (uint64_t)(p >> 64);
+    uint64_t low = (uint64_t)p;
+    if (low & (1ULL << 63)) high++;
+    result.f = high;
+#else
+    const uint64_t M32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & M32;
+    uint64_t c = y.f >> 32, d = y.f & M32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1U << 31;
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+#endif
+    result.e = x.e + y.e + 64;
+    return result;
+}
+
+static DiyFp normalize(DiyFp x) {
+    int shift = __builtin_clzll(x.f);
+    x.f <<= shift;
+    x.e -= shift;
+    return x;
+}
+
+// 计算相邻两个double的中点 m- 与 m+, 并规范化到同一指数
+static void boundaries(DiyFp v, DiyFp* minus, DiyFp* plus) {
+    DiyFp p = {(v.f << 1) + 1, v.e - 1};
+    p = normalize(p);
+    DiyFp m;
+    if (v.f == HIDDEN_BIT) {
+        // 2的整数次幂 下方间距只有上方的一半
+        m.f = (v.f << 2) - 1;
+        m.e = v.e - 2;
+    } else {
+        m.f = (v.f << 1) - 1;
+        m.e = v.e - 1;
+    }
+    m.f <<= m.e - p.e;
+    m.e = p.e;
+    *minus = m;
+    *plus = p;
+}
+
+// 选取10^-k 使乘积的二进制指数落在[-60, -32]
+static DiyFp cachedPower(int e, int* k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) ik++;
+    int index = (ik >> 3) + 1;
+    *k = -(-348 + index * 8);
+    DiyFp result = {cachedPowersF[index], cachedPowersE[index]};
+    return result;
+}
+
+static int decimalDigits(uint32_t n) {
+    int count = 1;
+    while (count < 10 && n >= powersOf10[count]) count++;
+    return count;
+}
+
+// 在不越出安全区间的前提下 让末位尽量靠近真实值
+static void roundWeed(char* buffer, int length, uint64_t delta, uint64_t rest,
+                      uint64_t tenKappa, uint64_t distance) {
+    while (rest < distance && delta - rest >= tenKappa &&
+           (rest + tenKappa < distance ||
+            distance - rest > rest + tenKappa - distance)) {
+        buffer[length - 1]--;
+        rest += tenKappa;
+    }
+}
+
+// 逐位生成 直到剩余部分落入不确定区间delta内
+static int generateDigits(DiyFp w, DiyFp high, uint64_t delta, char* buffer,
+                          int* k) {
+    DiyFp one = {1ULL << -high.e, high.e};
+    uint64_t distance = high.f - w.f;
+    uint32_t p1 = (uint32_t)(high.f >> -one.e);
+    uint64_t p2 = high.f & (one.f - 1);
+    int kappa = decimalDigits(p1);
+    int length = 0;
+
+    // 整数部分
+    while (kappa > 0) {
+        uint32_t digit = p1 / powersOf10[kappa - 1];
+        p1 %= powersOf10[kappa - 1];
+        if (digit != 0 || length != 0) buffer[length++] = '0' + digit;
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            roundWeed(buffer, length, delta, rest,
+                      (uint64_t)powersOf10[kappa] << -one.e, distance);
+            return length;
+        }
+    }
+
+    // 小数部分
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        distance *= 10;
+        char digit = (char)(p2 >> -one.e);
+        if (digit != 0 || length != 0) buffer[length++] = '0' + digit;
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            roundWeed(buffer, length, delta, p2, one.f, distance);
+            return length;
+        }
+    }
+}
+
+// 生成正数value的最短数字串 value = digits * 10^k
+static int grisu2(double value, char* buffer, int* k) {
+    DiyFp v = fromDouble(value);
+    DiyFp minus, plus;
+    boundaries(v, &minus, &plus);
+
+    DiyFp power = cachedPower(plus.e, k);
+    DiyFp w = multiply(normalize(v), power);
+    DiyFp high = multiply(plus, power);
+    DiyFp low = multiply(minus, power);
+    // 收缩一个单位 抵消乘法的舍入误差
+    low.f++;
+    high.f--;
+    return generateDigits(w, high, high.f - low.f, buffer, k);
+}
+
+static int writeExponent(int exponent, char* buffer) {
+    char* start = buffer;
+    *buffer++ = 'e';
+    if (exponent < 0) {
+        *buffer++ = '-';
+        exponent = -exponent;
+    } else {
+        *buffer++ = '+';
+    }
+    if (exponent >= 100) {
+        *buffer++ = '0' + exponent / 100;
+        exponent %= 100;
+        *buffer++ = '0' + exponent / 10;
+    } else if (exponent >= 10) {
+        *buffer++ = '0' + exponent / 10;
+    }
+    *buffer++ = '0' + exponent % 10;
+    return (int)(buffer - start);
+}
+
+// 按JavaScript的规则摆放小数点与指数 digits中已有length位数字
+static int prettify(char* buffer, int length, int k) {
+    // 10^(point-1) <= value < 10^point
+    int point = length + k;
+
+    if (k >= 0 && point <= 21) {
+        // 整数: 补零
+        memset(buffer + length, '0', k);
+        return point;
+    }
+    if (point > 0 && point <= 21) {
+        // 1234e-2 -> 12.34
+        memmove(buffer + point + 1, buffer + point, length - point);
+        buffer[point] = '.';
+        return length + 1;
+    }
+    if (point > -6 && point <= 0) {
+        // 1234e-6 -> 0.001234
+        int offset = 2 - point;
+        memmove(buffer + offset, buffer, length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', offset - 2);
+        return length + offset;
+    }
+    if (length == 1) {
+        // 1e30
+        return 1 + writeExponent(point - 1, buffer + 1);
+    }
+    // 1234e30 -> 1.234e+33
+    memmove(buffer + 2, buffer + 1, length - 1);
+    buffer[1] = '.';
+    return length + 1 + writeExponent(point - 1, buffer + length + 1);
+}
+
+// 整数快速路径 直接逐位输出
+static int formatInteger(uint64_t magnitude, char* buffer) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+    for (int i = 0; i < count; i++) buffer[i] = digits[count - 1 - i];
+    return count;
+}
+
+int formatNumber(double value, char* buffer) {
+    char* start = buffer;
+    int length;
+
+    if (value != value) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if (signbit(value)) {
+        *buffer++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        *buffer++ = '0';
+    } else if (value > 1.7976931348623157e308) {
+        memcpy(buffer, "inf", 3);
+        buffer += 3;
+    } else if (value < EXACT_INTEGER_LIMIT && value == (double)(uint64_t)value) {
+        buffer += formatInteger((uint64_t)value, buffer);
+    } else {
+        int k;
+        length = grisu2(value, buffer, &k);
+        buffer += prettify(buffer, length, k);
+    }
+    *buffer = '\0';
+    return (int)(buffer - start);
+}
+
+// 1e0 ~ 1e22 都能被double精确表示
+static const double exactPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// 尾数超过2^53时交给strtod 字面量不以'\0'结尾, 先复制出来
+static double parseSlow(const char* chars, int length) {
+    char small[64];
+    char* copy = length < (int)sizeof(small) ? small : (char*)malloc(length + 1);
+    if (copy == NULL) exit(1);
+    memcpy(copy, chars, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != small) free(copy);
+    return value;
+}
+
+double parseNumber(const char* chars, int length) {
+    const char* end = chars + length;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool fraction = false;
+    bool truncated = false;
+
+    // 最多累积19位有效数字 不会溢出uint64
+    for (const char* c = chars; c < end; c++) {
+        if (*c == '.') {
+            fraction = true;
+            continue;
+        }
+        int digit = *c - '0';
+        if (digits < 19) {
+            mantissa = mantissa * 10 + digit;
+            if (mantissa != 0) digits++;
+            if (fraction) exponent--;
+        } else {
+            if (!fraction) exponent++;
+            if (digit != 0) truncated = true;
+        }
+    }
+
+    if (!truncated) {
+        // 整数快速路径: uint64到double的转换本身就是就近舍入
+        if (exponent == 0) return (double)mantissa;
+        // Clinger快速路径: 尾数与10的幂都能精确表示时 一次乘除即为正确舍入
+        if (mantissa <= (1ULL << 53) && exponent >= -22) {
+            return (double)mantissa / exactPowersOf10[-exponent];
+        }
+    }
+    return parseSlow(chars, length);
+}
@@ -1,11 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "include/vm.h"
+#include "include/hash.h"
 #include "include/table.h"
 #include "include/value.h"
 #include "include/memory.h"
 #include "include/object.h"
+#include "include/output.h"
 
 // 分配多种类型
 #define ALLOCATE_OBJ(type, objectType) \
@@ -41,16 +44,20 @@ ObjClass* newClass(ObjString* name) {
 }
 
 ObjClosure* newClosure(ObjFunction* function) {
-    // 分配上值数组空间并初始化
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*,
-                                    function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; i++)
+    // 分配上值数组空间并初始化 每个上值只会用到两个数组之一
+    int count = function->upvalueCount;
+    Value* values = (Value*)reallocate(NULL, 0, CLOSURE_CAPTURES_SIZE(count));
+    ObjUpvalue** upvalues = (ObjUpvalue**)(values + count);
+    for (int i = 0; i < count; i++) {
+        values[i] = NIL_VAL;
         upvalues[i] = NULL;
+    }
 
     // 创建闭包函数空间并初始化
     ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
     closure->function = function;
     closure->upvalues = upvalues;
+    closure->values = values;
     closure->upvalueCount = function->upvalueCount;
     return closure;
 }
@@ -60,6 +67,10 @@ ObjFunction* newFunction() {
     function->arity = 0;
     function->upvalueCount = 0;
     function->name = NULL;
+    function->lazySource = NULL;
+    function->lazyLine = 0;
+    function->lazyType = 0;
+    function->upvalueNames = NULL;
     initChunk(&function->chunk);
     return function;
 }
@@ -84,21 +95,19 @@ static ObjString* allocateString(char* chars, int length,
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->borrowed = false;
+    string->left = NULL;
+    string->right = NULL;
     push(OBJ_VAL(string));
     tableSet(&vm.strings, string, NIL_VAL);
     pop();
     return string;
 }
 
-// 计算字符串的哈希值
+// 计算字符串的哈希值 每次处理一个字(8字节)
 static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
-    int i = 0;
-    for (;i < length;i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
-    }
-    return hash;
+    uint64_t hash = hashBytes(key, (size_t)length, HASH_SEED);
+    return (uint32_t)(hash ^ (hash >> 32));
 }
 
 ObjString* takeString(char* chars, int length) {
@@ -123,6 +132,80 @@ ObjString* copyString(const char* chars, int length) {
     return allocateString(heapChars, length, hash);
 }
 
+ObjString* borrowString(const char* chars, int length) {
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = tableFindString(&vm.strings, chars, length,
+                                          hash);
+    if (interned != NULL) return interned;
+    ObjString* string = allocateString((char*)chars, length, hash);
+    string->borrowed = true;
+    return string;
+}
+
+ObjString* newRope(ObjString* a, ObjString* b) {
+    ObjString* rope = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    rope->length = a->length + b->length;
+    rope->chars = NULL;
+    rope->hash = 0;
+    rope->borrowed = false;
+    rope->left = a;
+    rope->right = b;
+    return rope;
+}
+
+// 将绳索的全部字符按序写入dest 使用显式栈避免深层递归
+static void flattenRope(ObjString* rope, char* dest) {
+    int capacity = 64;
+    int count = 0;
+    ObjString** stack = (ObjString**)malloc(sizeof(ObjString*) * capacity);
+    if (stack == NULL) exit(1);
+
+    // 从尾部向前填充 右子串先出栈
+    char* end = dest + rope->length;
+    stack[count++] = rope;
+    while (count > 0) {
+        ObjString* node = stack[--count];
+        if (!IS_ROPE(node)) {
+            end -= node->length;
+            memcpy(end, node->chars, node->length);
+            continue;
+        }
+        if (capacity < count + 2) {
+            capacity *= 2;
+            stack = (ObjString**)realloc(stack,
+                                         sizeof(ObjString*) * capacity);
+            if (stack == NULL) exit(1);
+        }
+        stack[count++] = node->left;
+        stack[count++] = node->right;
+    }
+    free(stack);
+}
+
+ObjString* internString(ObjString* string) {
+    // 驻留字符串本身 或已展开的绳索
+    if (string->left == NULL) return string;
+    if (!IS_ROPE(string)) return string->left;
+
+    char* chars = ALLOCATE(char, string->length + 1);
+    flattenRope(string, chars);
+    chars[string->length] = '\0';
+    ObjString* interned = takeString(chars, string->length);
+
+    // 共享驻留字符 并释放对子串的引用
+    string->chars = interned->chars;
+    string->hash = interned->hash;
+    string->left = interned;
+    string->right = NULL;
+    return interned;
+}
+
+bool stringsEqual(ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    if (a->length != b->length) return false;
+    return internString(a) == internString(b);
+}
+
 ObjUpvalue* newUpvalue(Value* slot) {
     ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
     upvalue->closed = NIL_VAL;
@@ -134,10 +217,12 @@ ObjUpvalue* newUpvalue(Value* slot) {
 // 打印函数对象
 static void printFunction(ObjFunction* function) {
     if (function->name == NULL) {
-        printf("<script>");
+        writeString("<script>");
         return;
     }
-    printf("<fn %s>", function->name->chars);
+    writeString("<fn ");
+    writeOutput(function->name->chars, function->name->length);
+    writeString(">");
 }
 
 void printObject(Value value) {
@@ -145,27 +230,48 @@ void printObject(Value value) {
         case OBJ_BOUND_METHOD:
             printFunction(AS_BOUND_METHOD(value)->method->function);
             break;
-        case OBJ_CLASS:
-            printf("%s", AS_CLASS(value)->name->chars);
+        case OBJ_CLASS: {
+            ObjString* name = AS_CLASS(value)->name;
+            writeOutput(name->chars, name->length);
             break;
+        }
         case OBJ_CLOSURE:
             printFunction(AS_CLOSURE(value)->function);
             break;
         case OBJ_FUNCTION:
             printFunction(AS_FUNCTION(value));
             break;
-        case OBJ_INSTANCE:
-            printf("<%s instance>",
-                AS_INSTANCE(value)->class->name->chars);
+        case OBJ_INSTANCE: {
+            ObjString* name = AS_INSTANCE(value)->class->name;
+            writeString("<");
+            writeOutput(name->chars, name->length);
+            writeString(" instance>");
             break;
+        }
         case OBJ_NATIVE:
-            printf("<native function>");
+            writeString("<native function>");
             break;
-        case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+        case OBJ_STRING: {
+            ObjString* string = AS_STRING(value);
+            if (!IS_ROPE(string)) {
+                writeOutput(string->chars, string->length);
+                break;
+            }
+            // 打印时不驻留 避免在GC日志中分配对象; 能放下时直接展开到输出缓冲区
+            char* chars = reserveOutput(string->length);
+            if (chars != NULL) {
+                flattenRope(string, chars);
+                break;
+            }
+            chars = (char*)malloc(string->length);
+            if (chars == NULL) exit(1);
+            flattenRope(string, chars);
+            writeOutput(chars, string->length);
+            free(chars);
             break;
+        }
         case OBJ_UPVALUE:
-            printf("<upvalue>");
+            writeString("<upvalue>");
             break;
     }
 }
\ No newline at end of file
@@ -0,0 +1,614 @@
+#include <stdlib.h>
+
+#include "include/memory.h"
+#include "include/object.h"
+#include "include/optimizer.h"
+
+// 优化轮数上限
+#define MAX_ROUNDS 8
+// 跳转链最多追踪的长度 防止在跳转环中打转
+#define MAX_THREAD_HOPS 16
+
+// 解码后的指令
+typedef struct {
+    uint8_t op;
+    int offset; // 在原代码中的偏移量, 操作数从原代码读取
+    int length;
+    bool fused; // 融合生成的指令, 操作数保存在operands中
+    uint8_t operands[2];
+    int line;
+    int target; // 跳转目标的指令下标, 非跳转指令为-1
+    bool live;  // 被删除后为false
+} Instruction;
+
+// 一个函数的指令序列
+typedef struct {
+    Chunk* chunk;
+    Instruction* code;
+    int count;
+    int* next;    // next[i]: 下标不小于i的第一条存活指令, count表示末尾
+    bool* leader; // 是否为存活跳转指令的目标, 即基本块的首指令
+} Program;
+
+// 按栈顶真假跳转
+static bool isBranch(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+// 条件跳转只能向前
+static bool isConditional(uint8_t op) {
+    return isBranch(op) || op == OP_INLINE_GUARD;
+}
+
+// 跳转指令的偏移量位于指令末尾, 相对于下一条指令
+// 长格式跳转解码时换成一般格式, 编码时再按距离选择
+static bool isJump(uint8_t op) {
+    return op == OP_JUMP || op == OP_LOOP || isConditional(op);
+}
+
+// 跳转偏移量的字节数: 长格式三字节, 其余(含INLINE_GUARD)两字节
+static int jumpWidth(Instruction* instruction) {
+    return instruction->op != OP_INLINE_GUARD &&
+           instruction->length == 4 ? 3 : 2;
+}
+
+static void* allocate(size_t size) {
+    void* result = malloc(size);
+    if (result == NULL) exit(1);
+    return result;
+}
+
+static void decode(Chunk* chunk, Program* program) {
+    int* indexOf = (int*)allocate(sizeof(int) * (chunk->count + 1));
+    program->chunk = chunk;
+    program->code = (Instruction*)allocate(sizeof(Instruction) * chunk->count);
+    program->count = 0;
+
+    int run = 0; // 当前字节所在的行号段
+    for (int offset = 0; offset < chunk->count;) {
+        Instruction* instruction = &program->code[program->count];
+        indexOf[offset] = program->count++;
+        instruction->op = chunk->code[offset];
+        if (isJump(normalForm(instruction->op))) {
+            instruction->op = normalForm(instruction->op);
+        }
+        instruction->offset = offset;
+        instruction->length = instructionLength(chunk, offset);
+        while (run + 1 < chunk->lineCount &&
+               chunk->lines[run + 1].offset <= offset) {
+            run++;
+        }
+        instruction->line = chunk->lines[run].line;
+        instruction->target = -1;
+        instruction->live = true;
+        instruction->fused = false;
+        offset += instruction->length;
+    }
+    indexOf[chunk->count] = program->count;
+
+    // 跳转偏移量换成指令下标
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!isJump(instruction->op)) continue;
+        int end = instruction->offset + instruction->length;
+        int jump = jumpWidth(instruction) == 3
+            ? readLong(&chunk->code[end - 3])
+            : (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+        int target = instruction->op == OP_LOOP ? end - jump : end + jump;
+        instruction->target = indexOf[target];
+        if (instruction->op != OP_INLINE_GUARD) instruction->length = 3;
+    }
+
+    program->next = (int*)allocate(sizeof(int) * (program->count + 1));
+    program->leader = (bool*)allocate(sizeof(bool) * (program->count + 1));
+    free(indexOf);
+}
+
+static void freeProgram(Program* program) {
+    free(program->code);
+    free(program->next);
+    free(program->leader);
+}
+
+// 删除指令后重新计算next与leader
+static void analyze(Program* program) {
+    program->next[program->count] = program->count;
+    program->leader[program->count] = false;
+    for (int i = program->count - 1; i >= 0; i--) {
+        program->next[i] = program->code[i].live ? i : program->next[i + 1];
+        program->leader[i] = false;
+    }
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (instruction->live && isJump(instruction->op)) {
+            program->leader[program->next[instruction->target]] = true;
+        }
+    }
+}
+
+static int previousLive(Program* program, int index) {
+    for (int i = index - 1; i >= 0; i--) {
+        if (program->code[i].live) return i;
+    }
+    return -1;
+}
+
+static uint8_t operand(Program* program, int index) {
+    Instruction* instruction = &program->code[index];
+    if (instruction->fused) return instruction->operands[0];
+    return program->chunk->code[instruction->offset + 1];
+}
+
+// 压入常量的指令 取出常量值
+static bool constantValue(Program* program, int index, Value* value) {
+    switch (program->code[index].op) {
+        case OP_NIL:   *value = NIL_VAL; return true;
+        case OP_TRUE:  *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        case OP_CONSTANT:
+            *value = program->chunk->constants.values[operand(program, index)];
+            return true;
+        case OP_SMALL_INT:
+            *value = NUMBER_VAL((int8_t)operand(program, index));
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 常量条件: 条件跳转必然发生时改为无条件跳转, 必然不发生时删除
+static bool foldConstantBranches(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        // 有其他前驱时栈顶不一定是这个常量
+        if (!instruction->live || !isBranch(instruction->op) ||
+            program->leader[i]) {
+            continue;
+        }
+        int previous = previousLive(program, i);
+        Value value;
+        if (previous == -1 || !constantValue(program, previous, &value)) {
+            continue;
+        }
+        bool falsey = IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+        if (falsey == (instruction->op == OP_JUMP_IF_FALSE)) {
+            instruction->op = OP_JUMP;
+        } else {
+            instruction->live = false;
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+// 跳转线程化: 跳到无条件跳转的指令直接跳到最终目标;
+// 条件跳转不弹出条件, 跳到同类按真假的跳转时结果相同
+static bool threadJumps(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!instruction->live || !isJump(instruction->op)) continue;
+        bool conditional = isConditional(instruction->op);
+
+        int target = program->next[instruction->target];
+        for (int hop = 0; hop < MAX_THREAD_HOPS && target < program->count;
+             hop++) {
+            Instruction* next = &program->code[target];
+            if (!isJump(next->op)) break;
+            if (isConditional(next->op) &&
+                (!isBranch(next->op) || next->op != instruction->op)) {
+                break;
+            }
+            int final = program->next[next->target];
+            // 条件跳转只能向前
+            if (final == target || (conditional && final <= i)) break;
+            target = final;
+        }
+
+        if (target == program->next[i + 1]) {
+            // 跳到紧随其后的指令
+            instruction->live = false;
+            changed = true;
+        } else if (target != program->next[instruction->target]) {
+            instruction->target = target;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// 删除从入口不可达的指令
+static bool removeUnreachable(Program* program) {
+    bool* reached = (bool*)calloc(program->count + 1, sizeof(bool));
+    int* worklist = (int*)allocate(sizeof(int) * (program->count * 2 + 1));
+    if (reached == NULL) exit(1);
+    int top = 0;
+    worklist[top++] = program->next[0];
+
+    while (top > 0) {
+        int i = worklist[--top];
+        if (i >= program->count || reached[i]) continue;
+        reached[i] = true;
+        uint8_t op = program->code[i].op;
+        if (isJump(op)) {
+            worklist[top++] = program->next[program->code[i].target];
+        }
+        if (op != OP_JUMP && op != OP_LOOP && op != OP_RETURN) {
+            worklist[top++] = program->next[i + 1];
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        if (program->code[i].live && !reached[i]) {
+            program->code[i].live = false;
+            changed = true;
+        }
+    }
+    free(reached);
+    free(worklist);
+    return changed;
+}
+
+// 比较后取反合并为一条指令: EQUAL NOT -> NOT_EQUAL (<=、>=、!=)
+static bool fuseComparisons(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        uint8_t fused;
+        if (!instruction->live) continue;
+        switch (instruction->op) {
+            case OP_EQUAL:   fused = OP_NOT_EQUAL; break;
+            case OP_GREATER:
+            case OP_GREATER_NUMBER: fused = OP_NOT_GREATER; break;
+            case OP_LESS:
+            case OP_LESS_NUMBER:    fused = OP_NOT_LESS; break;
+            default: continue;
+        }
+        int negation = program->next[i + 1];
+        if (negation == program->count ||
+            program->code[negation].op != OP_NOT ||
+            program->leader[negation]) {
+            continue;
+        }
+        instruction->op = fused;
+        program->code[negation].live = false;
+        changed = true;
+    }
+    return changed;
+}
+
+// NOT; JUMP_IF_FALSE -> JUMP_IF_TRUE
+// 栈顶从!v变为v, 只在两个后继都先弹出条件时成立
+static bool invertBranches(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!instruction->live || instruction->op != OP_NOT) continue;
+        int jump = program->next[i + 1];
+        if (jump == program->count ||
+            program->code[jump].op != OP_JUMP_IF_FALSE ||
+            program->leader[jump]) {
+            continue;
+        }
+        int fallthrough = program->next[jump + 1];
+        int target = program->next[program->code[jump].target];
+        if (fallthrough == program->count || target == program->count ||
+            program->code[fallthrough].op != OP_POP ||
+            program->code[target].op != OP_POP) {
+            continue;
+        }
+        instruction->live = false;
+        program->code[jump].op = OP_JUMP_IF_TRUE;
+        changed = true;
+    }
+    return changed;
+}
+
+// 删除紧跟POP的无副作用压栈指令
+static bool removePurePops(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!instruction->live) continue;
+        switch (instruction->op) {
+            case OP_CONSTANT:
+            case OP_SMALL_INT:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_LOCAL:
+            case OP_GET_UPVALUE:
+            case OP_GET_CAPTURED:
+                break;
+            default:
+                continue;
+        }
+        int pop = program->next[i + 1];
+        if (pop == program->count || program->code[pop].op != OP_POP ||
+            program->leader[pop]) {
+            continue;
+        }
+        instruction->live = false;
+        program->code[pop].live = false;
+        changed = true;
+    }
+    return changed;
+}
+
+// 两条指令是否访问同一个变量
+static bool sameVariable(Program* program, int a, int b) {
+    uint8_t x = operand(program, a);
+    uint8_t y = operand(program, b);
+    if (program->code[a].op != OP_SET_GLOBAL) return x == y;
+    // 全局变量的操作数是变量名常量 同名变量的常量下标不一定相同
+    ValueArray* constants = &program->chunk->constants;
+    return valuesEqual(constants->values[x], constants->values[y]);
+}
+
+// 存储-加载转发: SET x; POP; GET x 中赋值的结果仍在栈顶, 删去POP与GET
+static bool forwardStores(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        uint8_t get;
+        if (!instruction->live) continue;
+        switch (instruction->op) {
+            case OP_SET_LOCAL:   get = OP_GET_LOCAL; break;
+            case OP_SET_UPVALUE: get = OP_GET_UPVALUE; break;
+            case OP_SET_GLOBAL:  get = OP_GET_GLOBAL; break;
+            default: continue;
+        }
+
+        int pop = program->next[i + 1];
+        if (pop == program->count || program->code[pop].op != OP_POP ||
+            program->leader[pop]) {
+            continue;
+        }
+        int load = program->next[pop + 1];
+        if (load == program->count || program->code[load].op != get ||
+            program->leader[load] || !sameVariable(program, i, load)) {
+            continue;
+        }
+        program->code[pop].live = false;
+        program->code[load].live = false;
+        changed = true;
+    }
+    return changed;
+}
+
+// 第index条之后的第n条存活指令 中间不能是基本块的首指令
+static int following(Program* program, int index, int n) {
+    for (int i = 0; i < n; i++) {
+        index = program->next[index + 1];
+        if (index == program->count || program->leader[index]) return -1;
+    }
+    return index;
+}
+
+// 把以first开头的连续指令替换成一条融合指令 其余指令删除
+static void fuse(Program* program, int first, int count, uint8_t op,
+                 uint8_t a, uint8_t b, int length) {
+    Instruction* instruction = &program->code[first];
+    for (int i = 1, index = first; i < count; i++) {
+        index = program->next[index + 1];
+        program->code[index].live = false;
+    }
+    instruction->op = op;
+    instruction->fused = true;
+    instruction->operands[0] = a;
+    instruction->operands[1] = b;
+    instruction->length = length;
+}
+
+/*
+ * -R: 把读写局部变量的指令序列融合成直接按槽位寻址的指令, 减少压栈出栈与分派
+ *   GET_LOCAL a; SMALL_INT n; ADD_NUMBER; SET_LOCAL a; POP -> INCREMENT_LOCAL a n
+ *   SET_LOCAL a; POP                                      -> STORE_LOCAL a
+ *   GET_LOCAL a; GET_LOCAL b                              -> GET_LOCAL_PAIR a b
+ *   GET_LOCAL a; CONSTANT k                               -> GET_LOCAL_CONSTANT a k
+ * 在其他优化收敛之后执行一次, 之前的变换不会看到融合指令
+ */
+static bool fuseSlots(Program* program, bool repl) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!instruction->live) continue;
+        int second = following(program, i, 1);
+        if (second == -1) continue;
+        uint8_t op = instruction->op;
+        uint8_t next = program->code[second].op;
+        // 操作数只在匹配到带操作数的指令后读取: 单字节指令(如末尾的RETURN)
+        // 之后没有操作数字节
+        if (op != OP_GET_LOCAL && op != OP_SET_LOCAL) continue;
+        uint8_t a = operand(program, i);
+
+        // 交互模式下POP会打印结果 不能删除
+        if (!repl && op == OP_GET_LOCAL && next == OP_SMALL_INT) {
+            uint8_t b = operand(program, second);
+            int add = following(program, i, 2);
+            int set = following(program, i, 3);
+            int pop = following(program, i, 4);
+            if (pop != -1 && program->code[add].op == OP_ADD_NUMBER &&
+                program->code[set].op == OP_SET_LOCAL &&
+                operand(program, set) == a &&
+                program->code[pop].op == OP_POP) {
+                fuse(program, i, 5, OP_INCREMENT_LOCAL, a, b, 3);
+                changed = true;
+                continue;
+            }
+        }
+        if (!repl && op == OP_SET_LOCAL && next == OP_POP) {
+            fuse(program, i, 2, OP_STORE_LOCAL, a, 0, 2);
+        } else if (op == OP_GET_LOCAL && next == OP_GET_LOCAL) {
+            fuse(program, i, 2, OP_GET_LOCAL_PAIR, a,
+                 operand(program, second), 3);
+        } else if (op == OP_GET_LOCAL && next == OP_CONSTANT) {
+            fuse(program, i, 2, OP_GET_LOCAL_CONSTANT, a,
+                 operand(program, second), 3);
+        } else {
+            continue;
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+// 短格式: 常用的小操作数内嵌在操作码中, 省去一个字节
+static bool shortenInstructions(Program* program) {
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!instruction->live || instruction->length != 2) continue;
+        uint8_t value = operand(program, i);
+        uint8_t op = instruction->op;
+        if (op == OP_GET_LOCAL && value <= 3) {
+            instruction->op = OP_GET_LOCAL_0 + value;
+        } else if (op == OP_GET_UPVALUE && value == 0) {
+            instruction->op = OP_GET_UPVALUE_0;
+        } else if (op == OP_CALL && value <= 2) {
+            instruction->op = OP_CALL_0 + value;
+        } else {
+            continue;
+        }
+        instruction->length = 1;
+        changed = true;
+    }
+    return changed;
+}
+
+// 按当前的指令长度计算每条指令的位置, 返回代码总长
+static int layout(Program* program, int* position) {
+    int size = 0;
+    for (int i = 0; i < program->count; i++) {
+        position[i] = size;
+        if (program->code[i].live) size += program->code[i].length;
+    }
+    position[program->count] = size;
+    return size;
+}
+
+// 重新编码 跳转偏移量超出范围时放弃并返回false
+static bool encode(Program* program) {
+    Chunk* chunk = program->chunk;
+    analyze(program);
+
+    // 跳转先按一般格式排布, 偏移量超出16位的改用长格式;
+    // 变长会拉远其他跳转, 重复直到不再有跳转变长
+    int* position = (int*)allocate(sizeof(int) * (program->count + 1));
+    int size;
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        size = layout(program, position);
+        for (int i = 0; i < program->count; i++) {
+            Instruction* instruction = &program->code[i];
+            if (!instruction->live || !isJump(instruction->op)) continue;
+            int distance = position[program->next[instruction->target]] -
+                           (position[i] + instruction->length);
+            if (distance < 0) distance = -distance;
+            int limit = jumpWidth(instruction) == 3 ? UINT24_MAX : UINT16_MAX;
+            if (distance <= limit) continue;
+            if (instruction->op == OP_INLINE_GUARD || limit == UINT24_MAX) {
+                free(position);
+                return false;
+            }
+            instruction->length = 4;
+            grown = true;
+        }
+    }
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (instruction->live && isConditional(instruction->op) &&
+            position[program->next[instruction->target]] < position[i]) {
+            free(position);
+            return false;
+        }
+    }
+
+    uint8_t* code = ALLOCATE(uint8_t, size);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    chunk->lines = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!instruction->live) continue;
+        int at = position[i];
+        addLine(chunk, at, instruction->line);
+        // 跳转的偏移量另行写入, 原代码中的宽度可能不同
+        int width = isJump(instruction->op) ? jumpWidth(instruction) : 0;
+        for (int j = 0; j < instruction->length - width; j++) {
+            code[at + j] = instruction->fused && j > 0
+                ? instruction->operands[j - 1]
+                : chunk->code[instruction->offset + j];
+        }
+        code[at] = instruction->op;
+        if (width == 0) continue;
+
+        // 按目标方向选择OP_JUMP或OP_LOOP
+        int end = at + instruction->length;
+        int distance = position[program->next[instruction->target]] - end;
+        uint8_t op = instruction->op;
+        if (!isConditional(op)) op = distance >= 0 ? OP_JUMP : OP_LOOP;
+        if (distance < 0) distance = -distance;
+        code[at] = width == 3 ? longForm(op) : op;
+        for (int j = 1; j <= width; j++) {
+            code[end - j] = distance & 0xff;
+            distance >>= 8;
+        }
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    chunk->code = code;
+    chunk->count = size;
+    chunk->capacity = size;
+    free(position);
+    return true;
+}
+
+typedef bool (*Pass)(Program* program);
+
+// 依次执行各个变换, 每次执行前重新计算基本块
+static bool runPasses(Program* program, Pass* passes, int count) {
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        analyze(program);
+        changed |= passes[i](program);
+    }
+    return changed;
+}
+
+void optimizeChunk(Chunk* chunk, int level, bool repl, bool registers) {
+    Pass passes[8];
+    int count = 0;
+    passes[count++] = fuseComparisons;
+    if (!repl) {
+        passes[count++] = invertBranches;
+        passes[count++] = removePurePops;
+    }
+    if (level > 0) {
+        passes[count++] = foldConstantBranches;
+        if (!repl) passes[count++] = forwardStores;
+    }
+    passes[count++] = threadJumps;
+    passes[count++] = removeUnreachable;
+
+    Program program;
+    decode(chunk, &program);
+
+    bool changed = true;
+    for (int round = 0; changed && round < MAX_ROUNDS; round++) {
+        changed = runPasses(&program, passes, count);
+    }
+    if (registers) {
+        analyze(&program);
+        fuseSlots(&program, repl);
+    }
+    shortenInstructions(&program);
+
+    // 编译器写入的前向跳转都是长格式, 即使没有其他变换也要重新编码
+    encode(&program);
+    freeProgram(&program);
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/number.h"
+#include "include/vm.h"
+#include "include/output.h"
+
+// 调试输出直接使用printf 为保持先后顺序每次写入后立即写出
+#if defined(DEBUG_PRINT_CODE) || defined(DEBUG_TRACE_EXECUTION) || \
+    defined(DEBUG_LOG_GC)
+#define OUTPUT_UNBUFFERED
+#endif
+
+void initOutput() {
+    static bool registered = false;
+    vm.output.count = 0;
+    vm.output.lineBuffered = isatty(STDOUT_FILENO);
+    if (!registered) {
+        atexit(flushOutput);
+        registered = true;
+    }
+}
+
+void flushOutput() {
+    if (vm.output.count > 0) {
+        fwrite(vm.output.buffer, sizeof(char), vm.output.count, stdout);
+        vm.output.count = 0;
+    }
+    fflush(stdout);
+}
+
+void writeOutput(const char* chars, int length) {
+    if (vm.output.count + length > OUTPUT_BUFFER_SIZE) {
+        flushOutput();
+        // 超过缓冲区大小的内容直接写出
+        if (length > OUTPUT_BUFFER_SIZE) {
+            fwrite(chars, sizeof(char), length, stdout);
+            return;
+        }
+    }
+    memcpy(vm.output.buffer + vm.output.count, chars, length);
+    vm.output.count += length;
+
+#ifdef OUTPUT_UNBUFFERED
+    flushOutput();
+#else
+    if (vm.output.lineBuffered && memchr(chars, '\n', length) != NULL) {
+        flushOutput();
+    }
+#endif
+}
+
+void writeString(const char* string) {
+    writeOutput(string, (int)strlen(string));
+}
+
+char* reserveOutput(int length) {
+    if (length > OUTPUT_BUFFER_SIZE) return NULL;
+    if (vm.output.count + length > OUTPUT_BUFFER_SIZE) flushOutput();
+    char* chars = vm.output.buffer + vm.output.count;
+    vm.output.count += length;
+    return chars;
+}
+
+void writeNumber(double number) {
+    char chars[NUMBER_BUFFER_SIZE];
+    writeOutput(chars, formatNumber(number, chars));
+}
@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "include/common.h"
 #include "include/scanner.h"
 
@@ -14,9 +20,13 @@ typedef struct {
 Scanner scanner;
 
 void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    initScannerAt(source, 1);
+}
+
+void initScannerAt(const char* position, int line) {
+    scanner.start = position;
+    scanner.current = position;
+    scanner.line = line;
 }
 
 // 变量名字母检查
@@ -61,6 +71,146 @@ static bool match(char expected) {
     return true;
 }
 
+// 可整段跳过的字符序列
+typedef enum {
+    RUN_SPACE,      // 空格、tab、回车与换行
+    RUN_COMMENT,    // 注释正文 到换行为止
+    RUN_STRING,     // 字符串正文 到引号为止
+    RUN_IDENTIFIER, // 字母、数字与下划线
+    RUN_DIGIT,      // 数字
+} RunKind;
+
+static inline bool inRun(char c, RunKind kind) {
+    switch (kind) {
+        case RUN_SPACE: return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        case RUN_COMMENT: return c != '\n' && c != '\0';
+        case RUN_STRING: return c != '"' && c != '\0';
+        case RUN_IDENTIFIER: return isAlpha(c) || isDigit(c);
+        case RUN_DIGIT: return isDigit(c);
+    }
+    return false;
+}
+
+// 多数标识符、数字与缩进都很短, 先逐字节看这么多个字节, 更长的序列才按块处理
+#define SCALAR_PREFIX 16
+
+// 按块比较: 以-mavx2编译时每块32字节, 否则SSE2每块16字节, 都没有时逐字节
+#if defined(__AVX2__)
+#define BLOCK_WIDTH 32
+typedef __m256i Block;
+#define BLOCK_LOAD(p) _mm256_load_si256((const __m256i*)(p))
+#define BLOCK_SET(c) _mm256_set1_epi8(c)
+#define BLOCK_EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define BLOCK_GT(a, b) _mm256_cmpgt_epi8(a, b)
+#define BLOCK_OR(a, b) _mm256_or_si256(a, b)
+#define BLOCK_AND(a, b) _mm256_and_si256(a, b)
+#define BLOCK_MASK(v) ((uint32_t)_mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+#define BLOCK_WIDTH 16
+typedef __m128i Block;
+#define BLOCK_LOAD(p) _mm_load_si128((const __m128i*)(p))
+#define BLOCK_SET(c) _mm_set1_epi8(c)
+#define BLOCK_EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define BLOCK_GT(a, b) _mm_cmpgt_epi8(a, b)
+#define BLOCK_OR(a, b) _mm_or_si128(a, b)
+#define BLOCK_AND(a, b) _mm_and_si128(a, b)
+#define BLOCK_MASK(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+#ifdef BLOCK_WIDTH
+#define BLOCK_FULL ((uint32_t)((1ull << BLOCK_WIDTH) - 1))
+
+// c在[low, high]之间的字节(按有符号比较, 非ASCII字节都不在范围内)
+static inline Block inRange(Block block, char low, char high) {
+    return BLOCK_AND(BLOCK_GT(block, BLOCK_SET(low - 1)),
+                     BLOCK_GT(BLOCK_SET(high + 1), block));
+}
+
+// 块中使序列结束的字节('\0'总会结束序列)
+static inline uint32_t stopMask(Block block, RunKind kind) {
+    switch (kind) {
+        case RUN_SPACE: {
+            Block space = BLOCK_OR(
+                BLOCK_OR(BLOCK_EQ(block, BLOCK_SET(' ')),
+                         BLOCK_EQ(block, BLOCK_SET('\t'))),
+                BLOCK_OR(BLOCK_EQ(block, BLOCK_SET('\r')),
+                         BLOCK_EQ(block, BLOCK_SET('\n'))));
+            return ~BLOCK_MASK(space) & BLOCK_FULL;
+        }
+        case RUN_COMMENT:
+            return BLOCK_MASK(BLOCK_OR(BLOCK_EQ(block, BLOCK_SET('\n')),
+                                       BLOCK_EQ(block, BLOCK_SET('\0'))));
+        case RUN_STRING:
+            return BLOCK_MASK(BLOCK_OR(BLOCK_EQ(block, BLOCK_SET('"')),
+                                       BLOCK_EQ(block, BLOCK_SET('\0'))));
+        case RUN_IDENTIFIER: {
+            // 字母不分大小写: 或上0x20后都落在小写字母范围内
+            Block lower = BLOCK_OR(block, BLOCK_SET(0x20));
+            Block word = BLOCK_OR(
+                BLOCK_OR(inRange(lower, 'a', 'z'), inRange(block, '0', '9')),
+                BLOCK_EQ(block, BLOCK_SET('_')));
+            return ~BLOCK_MASK(word) & BLOCK_FULL;
+        }
+        case RUN_DIGIT:
+            return ~BLOCK_MASK(inRange(block, '0', '9')) & BLOCK_FULL;
+    }
+    return BLOCK_FULL;
+}
+
+// 掩码中置位的个数 块内换行通常只有一两个, 不依赖popcnt指令
+static inline int countBits(uint32_t mask) {
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) count++;
+    return count;
+}
+
+/*
+ * 从整块对齐处起逐块查找kind序列的结尾, lines非NULL时累加跳过的换行数
+ * 对齐的块不会跨页, 但可能读到源码结尾'\0'之后同一块中的字节
+ * (只参与比较, 结果会被丢弃), 因此不做地址检查
+ */
+__attribute__((no_sanitize_address))
+static const char* skipBlocks(const char* p, RunKind kind, int* lines) {
+    size_t misalign = (uintptr_t)p % BLOCK_WIDTH;
+    const char* block = p - misalign;
+    uint32_t from = (BLOCK_FULL << misalign) & BLOCK_FULL; // 跳过p之前的字节
+    for (;;) {
+        Block bytes = BLOCK_LOAD(block);
+        uint32_t stop = stopMask(bytes, kind) & from;
+        uint32_t newlines = 0;
+        if (lines != NULL) {
+            newlines = BLOCK_MASK(BLOCK_EQ(bytes, BLOCK_SET('\n'))) & from;
+        }
+        if (stop != 0) {
+            int index = __builtin_ctz(stop);
+            if (lines != NULL) {
+                *lines += countBits(newlines & ((1u << index) - 1));
+            }
+            return block + index;
+        }
+        if (lines != NULL) *lines += countBits(newlines);
+        block += BLOCK_WIDTH;
+        from = BLOCK_FULL;
+    }
+}
+#endif
+
+// 返回从p开始的kind序列之后的位置, lines非NULL时累加跳过的换行数
+static inline const char* skipRun(const char* p, RunKind kind, int* lines) {
+    for (int i = 0; i < SCALAR_PREFIX; i++, p++) {
+        if (!inRun(*p, kind)) return p;
+        if (lines != NULL && *p == '\n') (*lines)++;
+    }
+#ifdef BLOCK_WIDTH
+    return skipBlocks(p, kind, lines);
+#else
+    for (; inRun(*p, kind); p++) {
+        if (lines != NULL && *p == '\n') (*lines)++;
+    }
+    return p;
+#endif
+}
+
 // 标识正确返回
 static Token makeToken(TokenType type) {
     Token token;
@@ -84,116 +234,80 @@ static Token errorToken(const char* message) {
 // 预处理 跳过空格，tab，换行及注释
 static void skipWhitespace() {
     for (;;) {
-        char c = peek();
-        switch (c) {
-            case ' ':
-            case '\r':
-            case '\t':
-                advance();
-                break;
-            case '\n':
-                scanner.line++;
-                advance();
-                break;
-            case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' && !isAtEnd()) advance();
-                } else {
-                    return;
-                }
-                break;
-            default:
-                return;
-        }
+        int lines = 0;
+        scanner.current = skipRun(scanner.current, RUN_SPACE, &lines);
+        scanner.line += lines;
+        if (peek() != '/' || peekNext() != '/') return;
+        scanner.current = skipRun(scanner.current, RUN_COMMENT, NULL);
     }
 }
 
-// 检查关键字
-static TokenType checkKeyword(int start, int length,
-                              const char* rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
-       return type;
-    }
-    return TOKEN_IDENTIFIER;
-    }
+/*
+ * 关键字的完美哈希: 长度、首字符与末字符算出的槽在32个中互不相同,
+ * 识别只需一次哈希与一次比较。各关键字是switch中按槽排列的case,
+ * 两个关键字落到同一槽时case重复, 编译即失败, 此时换一个乘数
+ */
+#define KEYWORD_HASH(length, first, last) \
+    (((length) + 7 * (first) + (last)) & 31)
+
+#define KEYWORD(text, first, last, type)                                 \
+    case KEYWORD_HASH(sizeof(text) - 1, first, last):                    \
+        if (length == sizeof(text) - 1 &&                                \
+            memcmp(scanner.start, text, sizeof(text) - 1) == 0) {        \
+            return type;                                                 \
+        }                                                                \
+        return TOKEN_IDENTIFIER;
 
-// 标识符识别 AST树
+// 标识符识别
 static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'b': return checkKeyword(1, 4, "reak", TOKEN_BREAK);
-        case 'c': 
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'l': return checkKeyword(2, 3, "ass", TOKEN_CLASS);
-                    case 'o': return checkKeyword(2, 6, "ntinue", TOKEN_CONTINUE);
-                }
-            }
-            break;
-        return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'f': 
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-                    case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': 
-        if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'e': return checkKeyword(2, 4, "turn", TOKEN_RETURN);
-                }
-        }
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-        
+    int length = (int)(scanner.current - scanner.start);
+    switch (KEYWORD_HASH(length, scanner.start[0], scanner.start[length - 1])) {
+        KEYWORD("and", 'a', 'd', TOKEN_AND)
+        KEYWORD("break", 'b', 'k', TOKEN_BREAK)
+        KEYWORD("class", 'c', 's', TOKEN_CLASS)
+        KEYWORD("continue", 'c', 'e', TOKEN_CONTINUE)
+        KEYWORD("else", 'e', 'e', TOKEN_ELSE)
+        KEYWORD("false", 'f', 'e', TOKEN_FALSE)
+        KEYWORD("for", 'f', 'r', TOKEN_FOR)
+        KEYWORD("fun", 'f', 'n', TOKEN_FUN)
+        KEYWORD("if", 'i', 'f', TOKEN_IF)
+        KEYWORD("nil", 'n', 'l', TOKEN_NIL)
+        KEYWORD("or", 'o', 'r', TOKEN_OR)
+        KEYWORD("print", 'p', 't', TOKEN_PRINT)
+        KEYWORD("return", 'r', 'n', TOKEN_RETURN)
+        KEYWORD("super", 's', 'r', TOKEN_SUPER)
+        KEYWORD("this", 't', 's', TOKEN_THIS)
+        KEYWORD("true", 't', 'e', TOKEN_TRUE)
+        KEYWORD("var", 'v', 'r', TOKEN_VAR)
+        KEYWORD("while", 'w', 'e', TOKEN_WHILE)
     }
     return TOKEN_IDENTIFIER;
 }
 
+#undef KEYWORD
+
 // 检查特定标识符
 static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
+    scanner.current = skipRun(scanner.current, RUN_IDENTIFIER, NULL);
     return makeToken(identifierType());
 }
 
 // 浮点数
 static Token number() {
-    while (isDigit(peek())) advance();
+    scanner.current = skipRun(scanner.current, RUN_DIGIT, NULL);
 
     if (peek() == '.' && isDigit(peekNext())) {
         advance();
-
-        while (isDigit(peek())) advance();
-
+        scanner.current = skipRun(scanner.current, RUN_DIGIT, NULL);
     }
     return makeToken(TOKEN_NUMBER);
 }
 
 // 处理字符串
 static Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
-    }
+    int lines = 0;
+    scanner.current = skipRun(scanner.current, RUN_STRING, &lines);
+    scanner.line += lines;
 
     if (isAtEnd()) return errorToken("Unterminated string.");
 
@@ -1,117 +1,323 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "include/value.h"
 #include "include/table.h"
 #include "include/common.h"
 #include "include/object.h"
 #include "include/memory.h"
 
-// 负载系数 capacity/count
-#define TABLE_MAX_LOAD 0.75
+// 控制字节: 最高位为1表示空槽或墓碑, 否则为哈希值的低7位
+#define CTRL_EMPTY   ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+// 每组控制字节数 也是最小容量
+#define GROUP_WIDTH 16
+
+// 负载系数 (count + tombstones) / capacity
+#define TABLE_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+// 删除后键值对少于容量的该比例时收缩
+#define TABLE_SHRINK_LOAD(capacity) ((capacity) / 8)
+
+// 线性模式
+#define IS_LINEAR(table) ((table)->capacity <= TABLE_LINEAR_MAX)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((int8_t)((hash) & 0x7f))
+
+// 一组控制字节的匹配结果 每个匹配槽对应一位
+typedef uint64_t GroupMask;
+
+#if defined(__ARM_NEON)
+// NEON没有movemask: 窄化移位后每槽占4位, 只保留每组4位中的最高位
+static inline GroupMask neonMask(uint8x16_t cmp) {
+    uint8x8_t narrow = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrow), 0) &
+           0x8888888888888888ull;
+}
+#define MASK_INDEX(mask) (__builtin_ctzll(mask) >> 2)
+#else
+#define MASK_INDEX(mask) (__builtin_ctzll(mask))
+#endif
+
+// 组内控制字节等于byte的槽
+static inline GroupMask matchByte(const int8_t* group, int8_t byte) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#elif defined(__ARM_NEON)
+    return neonMask(vceqq_s8(vld1q_s8(group), vdupq_n_s8(byte)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (group[i] == byte) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+// 组内的空槽或墓碑(最高位为1)
+static inline GroupMask matchFree(const int8_t* group) {
+#if defined(__SSE2__)
+    return (GroupMask)_mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i*)group));
+#elif defined(__ARM_NEON)
+    return neonMask(vcltzq_s8(vld1q_s8(group)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (group[i] < 0) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+// 控制字节与条目数组(或线性模式的键与值数组)共用一次分配
+static size_t tableSize(int capacity) {
+    if (capacity <= TABLE_LINEAR_MAX) {
+        return (sizeof(ObjString*) + sizeof(Value)) * capacity;
+    }
+    return sizeof(Entry) * capacity + sizeof(int8_t) * capacity;
+}
 
 void initTable(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(char, table->entries, tableSize(table->capacity));
     initTable(table);
 }
 
-// 由哈希值得到索引 遍历查找空桶进行插入
-static Entry* findEntry(Entry* entries, int capacity,
-                        ObjString* key) {
-    Entry* tombstone = NULL;
-    uint32_t index = key->hash & (capacity - 1);
-    for (;;) {
-        Entry* entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // 空列
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // 墓碑
-                if (tombstone == NULL) tombstone = entry;
-            }
+// 线性模式查找 按指针比较 容量为偶数, 每次比较两个键
+static int findLinear(Table* table, ObjString* key) {
+#if defined(__SSE2__) && UINTPTR_MAX == UINT64_MAX
+    __m128i needle = _mm_set1_epi64x((long long)(uintptr_t)key);
+    for (int i = 0; i < table->count; i += 2) {
+        __m128i keys = _mm_loadu_si128((const __m128i*)(table->keys + i));
+        // 64位指针相等 即其高低两个32位都相等
+        __m128i equal = _mm_cmpeq_epi32(keys, needle);
+        equal = _mm_and_si128(equal,
+            _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+        int match = _mm_movemask_pd(_mm_castsi128_pd(equal));
+        if (match != 0) {
+            int index = i + __builtin_ctz(match);
+            return index < table->count ? index : -1;
         }
-        else if (entry->key == key) {
-            return entry;
+    }
+    return -1;
+#elif defined(__aarch64__)
+    uint64x2_t needle = vdupq_n_u64((uint64_t)(uintptr_t)key);
+    for (int i = 0; i < table->count; i += 2) {
+        uint64x2_t equal = vceqq_u64(
+            vld1q_u64((const uint64_t*)(table->keys + i)), needle);
+        if (vgetq_lane_u64(equal, 0)) return i;
+        if (vgetq_lane_u64(equal, 1)) return i + 1 < table->count ? i + 1 : -1;
+    }
+    return -1;
+#else
+    for (int i = 0; i < table->count; i++) {
+        if (table->keys[i] == key) return i;
+    }
+    return -1;
+#endif
+}
+
+// 按组进行三角探测 遇到含空槽的组即可确定键不存在
+static int findSlot(Table* table, ObjString* key) {
+    int8_t h2 = H2(key->hash);
+    uint32_t groupMask = table->capacity / GROUP_WIDTH - 1;
+    uint32_t group = H1(key->hash) & groupMask;
+    for (uint32_t step = 1;; step++) {
+        const int8_t* control = table->control + group * GROUP_WIDTH;
+        for (GroupMask match = matchByte(control, h2); match != 0;
+             match &= match - 1) {
+            int index = group * GROUP_WIDTH + MASK_INDEX(match);
+            if (table->entries[index].key == key) return index;
         }
-        index = (index + 1) & (capacity - 1);// 超出容量范围即返回起始位
+        if (matchByte(control, CTRL_EMPTY) != 0) return -1;
+        group = (group + step) & groupMask;
     }
+}
 
+// 沿探测序列找到第一个空槽或墓碑
+static int findFreeSlot(int8_t* control, int capacity, uint32_t hash) {
+    uint32_t groupMask = capacity / GROUP_WIDTH - 1;
+    uint32_t group = H1(hash) & groupMask;
+    for (uint32_t step = 1;; step++) {
+        GroupMask match = matchFree(control + group * GROUP_WIDTH);
+        if (match != 0) return group * GROUP_WIDTH + MASK_INDEX(match);
+        group = (group + step) & groupMask;
+    }
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    if (IS_LINEAR(table)) {
+        int index = findLinear(table, key);
+        if (index == -1) return false;
+        *value = table->values[index];
+        return true;
+    }
 
-    *value = entry->value;
+    int index = findSlot(table, key);
+    if (index == -1) return false;
+
+    *value = table->entries[index].value;
     return true;
 }
 
-// 调整哈希表大小
+// 调整哈希表大小 线性模式与哈希模式按容量互相转换, 重新插入时丢弃所有墓碑
 static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
-    int i = 0;
-    for (;i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
+    // 先分配再迁移 分配期间触发的GC看到的仍是完整的旧表
+    char* block = ALLOCATE(char, tableSize(capacity));
+    Table resized;
+    resized.count = 0;
+    resized.tombstones = 0;
+    resized.capacity = capacity;
+    if (capacity <= TABLE_LINEAR_MAX) {
+        resized.keys = (ObjString**)block;
+        resized.values = (Value*)(block + sizeof(ObjString*) * capacity);
+    } else {
+        resized.entries = (Entry*)block;
+        resized.control = (int8_t*)(block + sizeof(Entry) * capacity);
+        memset(resized.control, CTRL_EMPTY, capacity);
     }
 
-    table->count = 0;
-    for (i=0;i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (entry->key == NULL) continue;
+    for (int i = 0; i < table->capacity; i++) {
+        ObjString* key;
+        Value value;
+        if (IS_LINEAR(table)) {
+            if (i >= table->count) break;
+            key = table->keys[i];
+            value = table->values[i];
+        } else {
+            if (table->control[i] < 0) continue;
+            key = table->entries[i].key;
+            value = table->entries[i].value;
+        }
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        if (IS_LINEAR(&resized)) {
+            resized.keys[resized.count] = key;
+            resized.values[resized.count] = value;
+        } else {
+            int index = findFreeSlot(resized.control, capacity, key->hash);
+            resized.control[index] = H2(key->hash);
+            resized.entries[index].key = key;
+            resized.entries[index].value = value;
+        }
+        resized.count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(char, table->entries, tableSize(table->capacity));
+    *table = resized;
+}
 
-    table->entries = entries;
-    table->capacity = capacity;
+// 能容纳count个键值对的最小容量: 线性模式取2的幂, 哈希模式负载不超过3/4
+static int capacityFor(int count) {
+    if (count <= TABLE_LINEAR_MAX) {
+        int capacity = 2;
+        while (capacity < count) capacity *= 2;
+        return capacity;
+    }
+    int capacity = GROUP_WIDTH;
+    while (capacity - capacity / 4 < count) capacity *= 2;
+    return capacity;
 }
 
 bool tableSet(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    if (IS_LINEAR(table)) {
+        int index = findLinear(table, key);
+        if (index != -1) {
+            table->values[index] = value;
+            return false;
+        }
+        if (table->count + 1 > table->capacity) {
+            adjustCapacity(table, capacityFor(table->count + 1));
+        }
+        if (IS_LINEAR(table)) {
+            table->keys[table->count] = key;
+            table->values[table->count] = value;
+            table->count++;
+            return true;
+        }
+    } else {
+        int index = findSlot(table, key);
+        if (index != -1) {
+            table->entries[index].value = value;
+            return false;
+        }
+        if (table->count + table->tombstones + 1 >
+            TABLE_MAX_LOAD(table->capacity)) {
+            // 按实际键值对数重建: 墓碑多时原地重建或收缩, 否则扩容
+            adjustCapacity(table, capacityFor(table->count + 1));
+        }
     }
-    
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    // 只有插值入真正的空桶count才会增加
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    int index = findFreeSlot(table->control, table->capacity, key->hash);
+    if (table->control[index] == CTRL_DELETED) table->tombstones--;
+    table->control[index] = H2(key->hash);
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+    return true;
+}
+
+// 删除条目 线性模式以末尾条目填补, 哈希模式留下墓碑, 均不调整容量
+static void removeSlot(Table* table, int index) {
+    if (IS_LINEAR(table)) {
+        table->count--;
+        table->keys[index] = table->keys[table->count];
+        table->values[index] = table->values[table->count];
+        return;
+    }
+    table->control[index] = CTRL_DELETED;
+    table->entries[index].key = NULL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+    table->tombstones++;
 }
 
 bool tableDelete(Table* table, ObjString* key) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int index = IS_LINEAR(table) ? findLinear(table, key)
+                                 : findSlot(table, key);
+    if (index == -1) return false;
+
+    removeSlot(table, index);
 
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    // 键值对过少时收缩(可退回线性模式)
+    if (!IS_LINEAR(table) &&
+        table->count < TABLE_SHRINK_LOAD(table->capacity)) {
+        adjustCapacity(table, capacityFor(table->count));
+    }
     return true;
 }
 
 void tableAddAll(Table* from, Table* to) {
+    if (IS_LINEAR(from)) {
+        for (int i = 0; i < from->count; i++) {
+            tableSet(to, from->keys[i], from->values[i]);
+        }
+        return;
+    }
     for (int i = 0; i < from->capacity; i++) {
-        Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
+        if (from->control[i] >= 0) {
+            Entry* entry = &from->entries[i];
             tableSet(to, entry->key, entry->value);
         }
     }
@@ -121,34 +327,65 @@ ObjString* tableFindString(Table* table, const char* chars,
                            int length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash & (table->capacity - 1);
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) return NULL;
-        }else if (entry->key->length == length &&
-                  entry->key->hash == hash &&
-                  memcmp(entry->key->chars, chars, length) == 0) {
-            // find
-            return entry->key;
+    if (IS_LINEAR(table)) {
+        for (int i = 0; i < table->count; i++) {
+            ObjString* key = table->keys[i];
+            if (key->hash == hash && key->length == length &&
+                memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
+        }
+        return NULL;
+    }
+
+    int8_t h2 = H2(hash);
+    uint32_t groupMask = table->capacity / GROUP_WIDTH - 1;
+    uint32_t group = H1(hash) & groupMask;
+    for (uint32_t step = 1;; step++) {
+        const int8_t* control = table->control + group * GROUP_WIDTH;
+        for (GroupMask match = matchByte(control, h2); match != 0;
+             match &= match - 1) {
+            ObjString* key =
+                table->entries[group * GROUP_WIDTH + MASK_INDEX(match)].key;
+            if (key->length == length && key->hash == hash &&
+                memcmp(key->chars, chars, length) == 0) {
+                // find
+                return key;
+            }
         }
-        index = (index + 1) & (table->capacity - 1);
+        if (matchByte(control, CTRL_EMPTY) != 0) return NULL;
+        group = (group + step) & groupMask;
     }
 }
 
 void tableRemoveWhite(Table* table) {
+    // 在GC中调用 只留墓碑不收缩, 墓碑在下次重建时回收
+    if (IS_LINEAR(table)) {
+        for (int i = table->count - 1; i >= 0; i--) {
+            if (!table->keys[i]->obj.isMarked) removeSlot(table, i);
+        }
+        return;
+    }
     for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+        if (table->control[i] >= 0 &&
+            !table->entries[i].key->obj.isMarked) {
+            removeSlot(table, i);
         }
     }
 }
 
 void markTable(Table* table) {
+    if (IS_LINEAR(table)) {
+        for (int i = 0; i < table->count; i++) {
+            markObject((Obj*)table->keys[i]);
+            markValue(table->values[i]);
+        }
+        return;
+    }
     for (int i = 0; i < table->capacity; i++) {
+        if (table->control[i] < 0) continue;
         Entry* entry = &table->entries[i];
         markObject((Obj*)entry->key);
         markValue(entry->value);
     }
-}
\ No newline at end of file
+}
@@ -4,6 +4,7 @@
 #include "include/value.h"
 #include "include/memory.h"
 #include "include/object.h"
+#include "include/output.h"
 
 
 void initValueArray(ValueArray* array)
@@ -36,21 +37,21 @@ void freeValueArray(ValueArray* array)
 void printValue(Value value) {
 #ifdef NAN_BOXING
     if (IS_BOOL(value)) {
-        printf(AS_BOOL(value) ? "true" : "false");
+        writeString(AS_BOOL(value) ? "true" : "false");
     } else if (IS_NIL(value)) {
-        printf("nil");
+        writeString("nil");
     } else if (IS_NUMBER(value)) {
-        printf("%g", AS_NUMBER(value));
+        writeNumber(AS_NUMBER(value));
     }else if (IS_OBJ(value)) {
         printObject(value);
     }
 #else
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            writeString(AS_BOOL(value) ? "true" : "false");
             break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+        case VAL_NIL: writeString("nil"); break;
+        case VAL_NUMBER: writeNumber(AS_NUMBER(value)); break;
         case VAL_OBJ: printObject(value); break;
     }
 #endif // NAN_BOXING
@@ -58,6 +59,10 @@ void printValue(Value value) {
 
 // 值相等判断
 bool valuesEqual(Value a, Value b) {
+    // 绳索与驻留字符串不是同一对象 需按内容比较
+    if (IS_STRING(a) && IS_STRING(b)) {
+        return stringsEqual(AS_STRING(a), AS_STRING(b));
+    }
 #ifdef NAN_BOXING
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
@@ -21,6 +21,7 @@ uint16_t seed = 0xACE1u;;// 随机数种子
 VM vm;
 
 static void runtimeError(const char* format, ...);
+static void loadFunction(ObjFunction* function);
 
 static Value clockNative(int argCount, Value* args) {
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
@@ -30,7 +31,7 @@ static Value clockNative(int argCount, Value* args) {
 static Value randomValue(int argCount, Value* args) {
     
     if (argCount == 1) {seed = (uint16_t)AS_NUMBER(*args);}
-    if (argCount > 1) {printf("Value Error!\n");return NUMBER_VAL(-1);}
+    if (argCount > 1) {writeString("Value Error!\n");return NUMBER_VAL(-1);}
     uint16_t bit = ((seed >> 0) ^ (seed >> 2) ^ (seed >> 3) ^ (seed >> 5)) & 1;
     seed = (seed >> 1) | (bit << 15);
     return NUMBER_VAL(seed);
@@ -46,17 +47,17 @@ static Value realRandomValue(){
 // 根号分之一
 static Value Qrsqrt(int argCount, Value* args) {
     if (AS_NUMBER(*args) > 0 && argCount == 1) {
-        long i;
+        int32_t i;
         const float threehalfs = 1.5F;
         float x = AS_NUMBER(*args) * 0.5F;
         float y = AS_NUMBER(*args);
-        i = * (long *) &y;
+        memcpy(&i, &y, sizeof(float));
         i = 0x5f3759df - (i >> 1);
-        y = * (float *) &i;
+        memcpy(&y, &i, sizeof(float));
         y = y * (threehalfs - (x * y * y)); 
         return NUMBER_VAL(y);
     }
-    printf("Q_rsqrt need a greater zero number.\n");
+    writeString("Q_rsqrt need a greater zero number.\n");
     return NIL_VAL;
 }
 
@@ -71,7 +72,7 @@ static Value mSqrt(int argCount, Value* args) {
         }
         return NUMBER_VAL(y);
     } else {
-        printf("Value Error!\n");
+        writeString("Value Error!\n");
         return NIL_VAL;
     }
 }
@@ -81,6 +82,12 @@ static Value Exit() {
     exit(0);
 }
 
+// 写出输出缓冲区
+static Value flushNative(int argCount, Value* args) {
+    flushOutput();
+    return NIL_VAL;
+}
+
 static void resetStack() {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
@@ -90,6 +97,7 @@ static void resetStack() {
 static void runtimeError(const char* format, ...) {
     int i = 0;
     va_list args;
+    flushOutput(); // 先写出此前的输出 保持与错误信息的先后顺序
     va_start(args, format);
     vfprintf(stderr, format, args);
     va_end(args);
@@ -98,9 +106,9 @@ static void runtimeError(const char* format, ...) {
     for (i = vm.frameCount - 1; i >= 0; i--) {
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ",
-            function->chunk.lines[instruction]);
+        size_t instruction = frame->ip - function->chunk.words - 1;
+        fprintf(stderr, "[line %d] in ", getLine(&function->chunk,
+            function->chunk.wordOffsets[instruction]));
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -124,9 +132,11 @@ void initVM() {
     vm.objects = NULL;
     vm.bytesAllocated = 0;
     vm.nextGC = 1024 * 1024;
+    vm.compiling = false;
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    initOutput();
     initTable(&vm.globals);
     initTable(&vm.strings);
     vm.initString = NULL;
@@ -138,10 +148,16 @@ void initVM() {
     defineNative("rand", randomValue);
     defineNative("Rand", realRandomValue);
     defineNative("exit", Exit);
+    defineNative("flush", flushNative);
 
 }
 
 void freeVM() {
+    flushOutput();
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+    fprintf(stderr, "executed %llu instructions\n",
+            (unsigned long long)vm.instructionCount);
+#endif
     freeTable(&vm.globals);
     freeTable(&vm.strings);
     vm.initString = NULL;
@@ -178,9 +194,19 @@ static bool call(ObjClosure* closure, int argCount) {
         runtimeError("Stack overflow!");
         return false;
     }
+    // 延迟编译的函数体在第一次调用时编译并载入
+    ObjFunction* function = closure->function;
+    if (function->lazySource != NULL) {
+        if (!compileLazy(function)) {
+            runtimeError("Could not compile function '%s'.",
+                         function->name->chars);
+            return false;
+        }
+        loadFunction(function);
+    }
     CallFrame* frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
+    frame->ip = closure->function->chunk.words;
     frame->slots = vm.stackTop - argCount - 1;
     return true;
 }
@@ -312,24 +338,30 @@ static void defineMethod(ObjString* name) {
     pop();
 }
 
-// 连接字符串
+// 连接字符串 较长的结果以绳索形式延迟展开
 static void concatenate() {
     ObjString* b = AS_STRING(peek(0));
     ObjString* a = AS_STRING(peek(1));
 
     int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    ObjString* result;
+    if (length >= ROPE_MIN_LENGTH) {
+        result = newRope(a, b);
+    } else {
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        chars[length] = '\0';
+        result = takeString(chars, length);
+    }
 
-    ObjString* result = takeString(chars, length);
     pop();
     pop();
     push(OBJ_VAL(result));
 }
 
 static void mulcombine(int times, ObjString* a) {
+    a = internString(a);
     int length = a->length * times;
     char* chars = ALLOCATE(char, length + 1);
     int i = 0;
@@ -354,14 +386,18 @@ static InterpretResult run(int flag) {
 
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
 
-    #define READ_BYTE() (*frame->ip++)
-    
-    #define READ_SHORT() \
-        (frame->ip += 2, \
-        (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+    // 指令字的操作数: A、B为字节操作数, OPERAND为占满高24位的跳转目标或常量下标
+    #define OPERAND_A() ((uint8_t)(word >> 8))
+    #define OPERAND_B() ((uint8_t)(word >> 16))
+    #define OPERAND() (word >> 8)
 
-    #define READ_CONSTANT() \
-    (frame->closure->function->chunk.constants.values[READ_BYTE()])
+    #define JUMP_TO(target) \
+        (frame->ip = frame->closure->function->chunk.words + (target))
+
+    #define CONSTANT(index) \
+    (frame->closure->function->chunk.constants.values[index])
+
+    #define READ_CONSTANT() CONSTANT(OPERAND())
 
     #define READ_STRING() AS_STRING(READ_CONSTANT())
 
@@ -376,6 +412,15 @@ static InterpretResult run(int flag) {
             push(valueType(a op b)); \
         } while (false);
 
+    #define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+    // 操作数已在编译期证明是数字
+    #define NUMBER_OP(valueType, op) \
+        do { \
+            double b = AS_NUMBER(pop()); \
+            vm.stackTop[-1] = valueType(AS_NUMBER(vm.stackTop[-1]) op b); \
+        } while (false);
+
     for (;;){
 
 #ifdef DEBUG_TRACE_EXECUTION
@@ -386,38 +431,46 @@ static InterpretResult run(int flag) {
     }
     printf("\n");
     // 从当前栈帧读取数据
-    disassembleInstruction(&frame->closure->function->chunk,
-        (int)(frame->ip - frame->closure->function->chunk.code));
+    Chunk* traced = &frame->closure->function->chunk;
+    disassembleInstruction(traced,
+        traced->wordOffsets[frame->ip - traced->words]);
 #endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE())
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+        vm.instructionCount++;
+#endif
+
+        uint32_t word = *frame->ip++;
+        switch ((uint8_t)word)
         {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
                 push(constant);
                 break;
             }
+            case OP_SMALL_INT:
+                push(NUMBER_VAL((int8_t)OPERAND_A()));
+                break;
             case OP_NIL: push(NIL_VAL); break;
             case OP_TRUE: push(BOOL_VAL(true)); break;
             case OP_FALSE: push(BOOL_VAL(false)); break;
             case OP_POP: {
                 Value result = pop();
                 if (flag==1){
-                    printf("Ans = \n    ");
+                    writeString("Ans = \n    ");
                     printValue(result);
-                    printf("\n");
+                    writeString("\n");
                 }
                 break;
                 }
             case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
+                uint8_t slot = OPERAND_A();
                 push(frame->slots[slot]);
                 break;
             }
             case OP_SET_LOCAL: {
                 // 赋值表达式的值需留在栈上不必弹出
-                uint8_t slot = READ_BYTE();
+                uint8_t slot = OPERAND_A();
                 // 当前栈帧的槽
                 frame->slots[slot] = peek(0);
                 break;
@@ -461,15 +514,20 @@ static InterpretResult run(int flag) {
                 break;
             }
             case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
+                uint8_t slot = OPERAND_A();
                 push(*frame->closure->upvalues[slot]->location);
                 break;
             }
             case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
+                uint8_t slot = OPERAND_A();
                 *frame->closure->upvalues[slot]->location = peek(0);
                 break;
             }
+            case OP_GET_CAPTURED: {
+                uint8_t slot = OPERAND_A();
+                push(frame->closure->values[slot]);
+                break;
+            }
             case OP_GET_PROPERTY:{
                 // 检查是否为实例
                 if (!IS_INSTANCE(peek(0))) {
@@ -517,13 +575,24 @@ static InterpretResult run(int flag) {
                 break;
             }
             case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
+                // 比较绳索时可能分配内存 操作数留在栈上直至比较结束
+                bool equal = valuesEqual(peek(1), peek(0));
+                pop();
+                pop();
+                push(BOOL_VAL(equal));
                 break;
             }
             case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
             case OP_LESS:    BINARY_OP(BOOL_VAL, <); break;
+            case OP_NOT_EQUAL: {
+                bool equal = valuesEqual(peek(1), peek(0));
+                pop();
+                pop();
+                push(BOOL_VAL(!equal));
+                break;
+            }
+            case OP_NOT_GREATER: BINARY_OP(NOT_BOOL_VAL, >); break;
+            case OP_NOT_LESS:    BINARY_OP(NOT_BOOL_VAL, <); break;
             case OP_ADD: {
                 if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                     concatenate();
@@ -552,28 +621,32 @@ static InterpretResult run(int flag) {
                 break;
             }
             case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
+            case OP_ADD_NUMBER:      NUMBER_OP(NUMBER_VAL, +); break;
+            case OP_SUBTRACT_NUMBER: NUMBER_OP(NUMBER_VAL, -); break;
+            case OP_MULTIPLY_NUMBER: NUMBER_OP(NUMBER_VAL, *); break;
+            case OP_DIVIDE_NUMBER:   NUMBER_OP(NUMBER_VAL, /); break;
+            case OP_GREATER_NUMBER:  NUMBER_OP(BOOL_VAL, >); break;
+            case OP_LESS_NUMBER:     NUMBER_OP(BOOL_VAL, <); break;
+            case OP_NEGATE_NUMBER:
+                vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));
+                break;
             case OP_PRINT: {
                 printValue(pop());
-                printf("\n");
+                writeOutput("\n", 1);
                 break;
             }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
+            // OP_LOOP解码时已换成绝对目标的OP_JUMP
+            case OP_JUMP:
+                JUMP_TO(OPERAND());
                 break;
-            }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset;
+            case OP_JUMP_IF_FALSE:
+                if (isFalsey(peek(0))) JUMP_TO(OPERAND());
                 break;
-            }
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
+            case OP_JUMP_IF_TRUE:
+                if (!isFalsey(peek(0))) JUMP_TO(OPERAND());
                 break;
-            }
             case OP_CALL: {
-                int argCount = READ_BYTE();
+                int argCount = OPERAND_A();
                 if (!callValue(peek(argCount), argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -581,8 +654,8 @@ static InterpretResult run(int flag) {
                 break;
             }
             case OP_INVOKE: {
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
+                ObjString* method = AS_STRING(CONSTANT(OPERAND_A()));
+                int argCount = OPERAND_B();
                 if (!invoke(method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -591,8 +664,8 @@ static InterpretResult run(int flag) {
                 break;
             }
             case OP_SUPER_INVOKE: {
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
+                ObjString* method = AS_STRING(CONSTANT(OPERAND_A()));
+                int argCount = OPERAND_B();
                 ObjClass* superclass = AS_CLASS(pop());
                 if (!invokeFromClass(superclass, method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
@@ -606,17 +679,78 @@ static InterpretResult run(int flag) {
                 ObjClosure* closure = newClosure(function);
                 push(OBJ_VAL(closure));
                 for(int i = 0; i < closure->upvalueCount; i++) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t index = READ_BYTE();
-                    if (isLocal) {
-                        closure->upvalues[i] = 
-                            captureUpvalue(frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    uint32_t capture = *frame->ip++;
+                    uint8_t kind = (uint8_t)capture;
+                    uint8_t index = (uint8_t)(capture >> 8);
+                    switch (kind) {
+                        case CAPTURE_LOCAL:
+                            closure->upvalues[i] =
+                                captureUpvalue(frame->slots + index);
+                            break;
+                        case CAPTURE_UPVALUE:
+                            closure->upvalues[i] =
+                                frame->closure->upvalues[index];
+                            break;
+                        case CAPTURE_LOCAL_VALUE:
+                            closure->values[i] = frame->slots[index];
+                            break;
+                        case CAPTURE_UPVALUE_VALUE:
+                            closure->values[i] = frame->closure->values[index];
+                            break;
                     }
                 }
                 break;
             }
+            case OP_GET_LOCAL_PAIR: {
+                uint8_t a = OPERAND_A();
+                uint8_t b = OPERAND_B();
+                push(frame->slots[a]);
+                push(frame->slots[b]);
+                break;
+            }
+            case OP_GET_LOCAL_CONSTANT: {
+                uint8_t slot = OPERAND_A();
+                push(frame->slots[slot]);
+                push(CONSTANT(OPERAND_B()));
+                break;
+            }
+            case OP_STORE_LOCAL: {
+                uint8_t slot = OPERAND_A();
+                frame->slots[slot] = pop();
+                break;
+            }
+            case OP_INCREMENT_LOCAL: {
+                // 编译期已证明局部变量是数字
+                uint8_t slot = OPERAND_A();
+                double step = (int8_t)OPERAND_B();
+                frame->slots[slot] =
+                    NUMBER_VAL(AS_NUMBER(frame->slots[slot]) + step);
+                break;
+            }
+            case OP_PICK: {
+                uint8_t depth = OPERAND_A();
+                push(peek(depth));
+                break;
+            }
+            case OP_SLIDE: {
+                uint8_t count = OPERAND_A();
+                Value result = pop();
+                vm.stackTop -= count;
+                push(result);
+                break;
+            }
+            case OP_INLINE_GUARD: {
+                // 全局绑定仍是编译时的函数时执行内联代码, 否则跳到普通调用
+                ObjFunction* function = AS_FUNCTION(CONSTANT(OPERAND_A()));
+                uint8_t argCount = OPERAND_B();
+                uint32_t target = *frame->ip++;
+                Value callee = peek(argCount);
+                if (!IS_CLOSURE(callee) ||
+                    AS_CLOSURE(callee)->function != function) {
+                    JUMP_TO(target);
+                }
+                break;
+            }
             case OP_CLOSE_UPVALUE: {
                 closeUpvalues(vm.stackTop - 1);
                 pop();
@@ -654,19 +788,42 @@ static InterpretResult run(int flag) {
             }
         }
     }
-    #undef READ_BYTE
-    #undef READ_SHORT
+    #undef OPERAND_A
+    #undef OPERAND_B
+    #undef OPERAND
+    #undef CONSTANT
+    #undef JUMP_TO
     #undef READ_CONSTANT
     #undef READ_STRING
     #undef BINARY_OP
+    #undef NOT_BOOL_VAL
+    #undef NUMBER_OP
+}
+
+// 把函数及其常量表中的内层函数解码成执行用的指令字
+static void loadFunction(ObjFunction* function) {
+    if (function->chunk.words != NULL) return; // 交互模式下之前已载入
+    if (function->lazySource != NULL) return; // 第一次调用时再载入
+    decodeChunk(&function->chunk);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_FUNCTION(constant)) {
+            loadFunction(AS_FUNCTION(constant));
+        }
+    }
 }
 
 InterpretResult interpret(const char* source, int flag)
 {
     ObjFunction* function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
+    return interpretFunction(function, flag);
+}
 
+InterpretResult interpretFunction(ObjFunction* function, int flag)
+{
     push(OBJ_VAL(function));
+    loadFunction(function);
     ObjClosure* closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
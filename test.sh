@@ -8,28 +8,69 @@ NOCOLOR='\033[0m'
 compiler="./bin/clox-debug"
 dir="./test"
 echo > testInformation
+# 每个用例分别在不优化、-O、-R、-O -R与延迟编译(-L)下运行
+for option in "" "-O" "-R" "-O -R" "-L"; do
 for file in $(find ${dir} -name '*.lox'); do
     start_time=$(date +%s.%N)
     len=${#file}
     len=$((len - 7))
 
-    echo ${file##*/} >> testInformation
-	$compiler $file >> testInformation
+    echo ${file##*/} ${option} >> testInformation
+	$compiler ${option} $file >> testInformation 2>&1
     exit_state=$?
+    # 含"// expect runtime error"的用例须以运行时错误(70)退出
+    expected_state=0
+    grep -q "// expect runtime error" $file && expected_state=70
 
     echo >> testInformation
     end_time=$(date +%s.%N)
     runtime=$(echo "scale=3; ($end_time - $start_time) * 1000" | bc)
 
-    if [ $exit_state -eq 0 ]; then
+    if [ $exit_state -eq $expected_state ]; then
         if [ $len -lt 8 ]; then
-            echo "${YELLOW}${file##*/}${NOCOLOR}\t\t${GREEN}Run Success${NOCOLOR}\tExecuted in $runtime ms"
+            echo "${YELLOW}${file##*/}${NOCOLOR} ${option}\t\t${GREEN}Run Success${NOCOLOR}\tExecuted in $runtime ms"
         else
-            echo "${YELLOW}${file##*/}${NOCOLOR}\t${GREEN}Run Success${NOCOLOR}\tExecuted in $runtime ms"
+            echo "${YELLOW}${file##*/}${NOCOLOR} ${option}\t${GREEN}Run Success${NOCOLOR}\tExecuted in $runtime ms"
         fi
     else
         echo "Run Error" >> testInformation
-        echo "${YELLOW}${file##*/}${NOCOLOR} ${RED}Run Error${NOCOLOR}"
+        echo "${YELLOW}${file##*/}${NOCOLOR} ${option} ${RED}Run Error${NOCOLOR}"
+    fi
+done
+done
+
+# 输出: 各模式下发布版的标准输出须与不优化时相同, 含"// expect:"的用例
+# 不优化时的输出还须与这些注释一致(调试版会打印字节码, 不作比较;
+# 回溯中不含内联调用的帧, 只比较标准输出)
+for file in $(find ${dir} -name '*.lox' ! -name 'random.lox' ! -name 'if.lox'); do
+    baseline=$(./bin/clox --no-cache $file 2>/dev/null)
+    if grep -q "// expect:" $file; then
+        expected=$(grep -o "// expect:.*" $file | sed 's|^// expect: \{0,1\}||')
+        if [ "$baseline" = "$expected" ]; then
+            echo "${YELLOW}${file##*/}${NOCOLOR} expect\t${GREEN}Run Success${NOCOLOR}"
+        else
+            echo "${YELLOW}${file##*/}${NOCOLOR} expect ${RED}Output Differs${NOCOLOR}"
+        fi
+    fi
+    for option in "-O" "-R" "-O -R" "-L"; do
+        if [ "$(./bin/clox --no-cache ${option} $file 2>/dev/null)" = "$baseline" ]; then
+            echo "${YELLOW}${file##*/}${NOCOLOR} ${option} output\t${GREEN}Run Success${NOCOLOR}"
+        else
+            echo "${YELLOW}${file##*/}${NOCOLOR} ${option} output ${RED}Output Differs${NOCOLOR}"
+        fi
+    done
+done
+
+# 字节码文件: --compile写出的.loxc与源文件的运行结果须一致
+# (random.lox与if.lox输出随机数与耗时, 不作比较)
+mkdir -p ./bin/loxc
+for file in $(find ${dir} -name '*.lox' ! -name 'random.lox' ! -name 'if.lox'); do
+    bytecode=./bin/loxc/${file##*/}c
+    ./bin/clox --compile $file $bytecode
+    if [ "$(./bin/clox --no-cache $file 2>&1)" = "$(./bin/clox $bytecode 2>&1)" ]; then
+        echo "${YELLOW}${bytecode##*/}${NOCOLOR}\t\t${GREEN}Run Success${NOCOLOR}"
+    else
+        echo "${YELLOW}${bytecode##*/}${NOCOLOR} ${RED}Output Differs${NOCOLOR}"
     fi
 done
 